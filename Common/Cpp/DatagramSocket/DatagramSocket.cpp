@@ -1,7 +1,139 @@
 #include "DatagramSocket.h"
+#include "UringReceiver.h"
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include "errno.h"
 #include <iostream>
+#include <thread>
+
+/*********************************************************************************
+  Counters, common to all platforms
+*********************************************************************************/
+
+#ifdef _WIN32
+    #define DATAGRAM_ERROR_CODE_BASE 10000 // WSABASEERR
+#else
+    #define DATAGRAM_ERROR_CODE_BASE 0
+#endif
+
+static unsigned long long systemTimeNs()
+{
+    return static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+// Appended to logged errors when rate limiting skipped some of them
+static std::string suppressedText(unsigned long long suppressed)
+{
+    return suppressed > 0 ? " (" + std::to_string(suppressed) + " more errors since last report)" : std::string();
+}
+
+// Number of datagrams the sender sent, GRO coalesced datagrams hold several of them
+static unsigned long long datagramCount(const DatagramBuffer & datagram)
+{
+    return datagram.segmentSize > 0 ? (datagram.size + datagram.segmentSize - 1) / datagram.segmentSize : 1;
+}
+
+void DatagramSocketCounters::countSent(unsigned long long packets,unsigned long long bytes)
+{
+    m_packetsSent.fetch_add(packets,std::memory_order_relaxed);
+    m_bytesSent.fetch_add(bytes,std::memory_order_relaxed);
+}
+
+void DatagramSocketCounters::countReceived(unsigned long long packets,unsigned long long bytes)
+{
+    m_packetsReceived.fetch_add(packets,std::memory_order_relaxed);
+    m_bytesReceived.fetch_add(bytes,std::memory_order_relaxed);
+}
+
+void DatagramSocketCounters::countShortSend()
+{
+    m_shortSends.fetch_add(1,std::memory_order_relaxed);
+}
+
+void DatagramSocketCounters::countError(int code,bool sending,bool wouldBlock)
+{
+    (sending ? m_sendErrors : m_receiveErrors).fetch_add(1,std::memory_order_relaxed);
+    if (wouldBlock) {
+        m_sendWouldBlock.fetch_add(1,std::memory_order_relaxed);
+    }
+    const int index = code - DATAGRAM_ERROR_CODE_BASE;
+    m_errorsByCode[(index >= 0 && index < ErrorCodeCount) ? index : ErrorCodeCount].fetch_add(1,std::memory_order_relaxed);
+    m_lastError.store(code,std::memory_order_relaxed);
+    m_lastErrorTimeNs.store(systemTimeNs(),std::memory_order_relaxed);
+}
+
+bool DatagramSocketCounters::shouldLog(unsigned long long & suppressed)
+{
+    // Console writes are synchronous: under an error burst, logging each one would make it worse
+    const unsigned long long now = systemTimeNs();
+    unsigned long long lastLog = m_lastLogTimeNs.load(std::memory_order_relaxed);
+    if (now - lastLog < 1000000000ull || !m_lastLogTimeNs.compare_exchange_strong(lastLog,now,std::memory_order_relaxed)) {
+        m_suppressedLogs.fetch_add(1,std::memory_order_relaxed);
+        return false;
+    }
+    suppressed = m_suppressedLogs.exchange(0,std::memory_order_relaxed);
+    return true;
+}
+
+DatagramSocketStats DatagramSocketCounters::snapshot() const
+{
+    DatagramSocketStats stats;
+    stats.packetsSent = m_packetsSent.load(std::memory_order_relaxed);
+    stats.bytesSent = m_bytesSent.load(std::memory_order_relaxed);
+    stats.packetsReceived = m_packetsReceived.load(std::memory_order_relaxed);
+    stats.bytesReceived = m_bytesReceived.load(std::memory_order_relaxed);
+    stats.sendErrors = m_sendErrors.load(std::memory_order_relaxed);
+    stats.sendWouldBlock = m_sendWouldBlock.load(std::memory_order_relaxed);
+    stats.shortSends = m_shortSends.load(std::memory_order_relaxed);
+    stats.receiveErrors = m_receiveErrors.load(std::memory_order_relaxed);
+    stats.lastError = m_lastError.load(std::memory_order_relaxed);
+    stats.lastErrorTimeNs = m_lastErrorTimeNs.load(std::memory_order_relaxed);
+    for (int i=0; i<=ErrorCodeCount; i++) {
+        const unsigned long long count = m_errorsByCode[i].load(std::memory_order_relaxed);
+        if (count > 0) {
+            // Codes out of the table are reported as -1
+            stats.errorsByCode.push_back(std::make_pair(i < ErrorCodeCount ? i + DATAGRAM_ERROR_CODE_BASE : -1,count));
+        }
+    }
+    return stats;
+}
+
+void DatagramPacer::configure(unsigned long long bytesPerSecond,unsigned int burstBytes)
+{
+    const auto now = std::chrono::steady_clock::now();
+    const bool wasEnabled = enabled();
+    if (wasEnabled) {
+        // Changing the rate keeps the bytes already sent in the bucket, it doesn't grant a new burst
+        refill(now);
+    }
+    m_bytesPerSecond = bytesPerSecond;
+    m_burstBytes = (std::max)(burstBytes,1u);
+    m_tokens = wasEnabled ? (std::min<double>)(m_tokens,m_burstBytes) : m_burstBytes;
+    m_lastRefill = now;
+}
+
+void DatagramPacer::refill(std::chrono::steady_clock::time_point now)
+{
+    const double elapsed = std::chrono::duration<double>(now - m_lastRefill).count();
+    m_tokens = (std::min<double>)(m_burstBytes,m_tokens + elapsed * m_bytesPerSecond);
+    m_lastRefill = now;
+}
+
+void DatagramPacer::wait(unsigned int bytes)
+{
+    if (m_bytesPerSecond == 0) {
+        return;
+    }
+    refill(std::chrono::steady_clock::now());
+    const double needed = (std::min)(bytes,m_burstBytes);
+    if (m_tokens < needed) {
+        // Sleeps overshoot a bit, the bucket refills meanwhile so the average rate holds
+        std::this_thread::sleep_for(std::chrono::duration<double>((needed - m_tokens) / m_bytesPerSecond));
+        refill(std::chrono::steady_clock::now());
+    }
+    m_tokens -= bytes;
+}
 
 /*********************************************************************************
   UNIX version
@@ -11,7 +143,57 @@
 
 #include <arpa/inet.h>
 
-DatagramSocket::DatagramSocket(unsigned int interfaceIP, unsigned int port):
+#ifdef __linux__
+    #include <netinet/udp.h>
+    #include <linux/net_tstamp.h>
+    #include <linux/filter.h>
+    #include <linux/errqueue.h>
+    #ifndef SOL_UDP
+        #define SOL_UDP 17
+    #endif
+    #ifndef UDP_SEGMENT
+        #define UDP_SEGMENT 103
+    #endif
+    #ifndef UDP_GRO
+        #define UDP_GRO 104
+    #endif
+    #ifndef SO_ATTACH_REUSEPORT_CBPF
+        #define SO_ATTACH_REUSEPORT_CBPF 51
+    #endif
+    #ifndef SO_ZEROCOPY
+        #define SO_ZEROCOPY 60
+    #endif
+    #ifndef SO_BUSY_POLL
+        #define SO_BUSY_POLL 46
+    #endif
+    #ifndef SO_PREFER_BUSY_POLL
+        #define SO_PREFER_BUSY_POLL 69
+    #endif
+    #ifndef SO_MAX_PACING_RATE
+        #define SO_MAX_PACING_RATE 47
+    #endif
+    #ifndef MSG_ZEROCOPY
+        #define MSG_ZEROCOPY 0x4000000
+    #endif
+    #ifndef SO_EE_ORIGIN_ZEROCOPY
+        #define SO_EE_ORIGIN_ZEROCOPY 5
+    #endif
+    #ifndef SO_EE_CODE_ZEROCOPY_COPIED
+        #define SO_EE_CODE_ZEROCOPY_COPIED 1
+    #endif
+
+    // Ancillary data space reserved for each received datagram
+    #define RECV_CONTROL_SIZE 128
+#endif
+
+#ifndef SO_RCVBUFFORCE
+    #define SO_RCVBUFFORCE -1
+#endif
+#ifndef SO_SNDBUFFORCE
+    #define SO_SNDBUFFORCE -1
+#endif
+
+DatagramSocket::DatagramSocket(unsigned int interfaceIP, unsigned int port, const DatagramSocketOptions & options):
     m_port(port)
 {
     m_socket = socket(AF_INET,SOCK_DGRAM,0);
@@ -35,6 +217,67 @@ DatagramSocket::DatagramSocket(unsigned int interfaceIP, unsigned int port):
         }
     #endif
 
+    // Socket buffers: the default receive buffer is easily overflowed by a burst of chunks from a big frame
+    if (options.receiveBufferSize > 0) {
+        setBufferSize(SO_RCVBUF,SO_RCVBUFFORCE,"SO_RCVBUF",options.receiveBufferSize);
+    }
+    if (options.sendBufferSize > 0) {
+        setBufferSize(SO_SNDBUF,SO_SNDBUFFORCE,"SO_SNDBUF",options.sendBufferSize);
+    }
+
+    // Report datagrams dropped by the kernel on a full receive queue with each received datagram
+    if (options.reportKernelDrops) {
+        #ifdef SO_RXQ_OVFL
+            if (setsockopt(m_socket,SOL_SOCKET,SO_RXQ_OVFL,&yes,sizeof(int)) != 0) {
+                std::cout << "Error setting SO_RXQ_OVFL option" << std::endl;
+            }
+        #else
+            std::cout << "Kernel drop reporting is not available on this platform" << std::endl;
+        #endif
+    }
+
+    // Kernel arrival timestamps: SO_TIMESTAMPING also gives hardware timestamps when the adapter
+    // supports it, SO_TIMESTAMPNS is the fallback for older kernels
+    if (options.receiveTimestamps) {
+        #ifdef __linux__
+            int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+                        SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+            if (setsockopt(m_socket,SOL_SOCKET,SO_TIMESTAMPING,&flags,sizeof(flags)) != 0 &&
+                setsockopt(m_socket,SOL_SOCKET,SO_TIMESTAMPNS,&yes,sizeof(int)) != 0) {
+                std::cout << "Error setting SO_TIMESTAMPNS option" << std::endl;
+            }
+        #else
+            std::cout << "Kernel receive timestamps are not available on this platform" << std::endl;
+        #endif
+    }
+
+    // Busy polling: going over net.core.busy_read needs CAP_NET_ADMIN, preferring busy poll
+    // (Linux 5.11) also defers adapter interrupts while the application keeps polling
+    if (options.busyPollMicroseconds > 0) {
+        #ifdef __linux__
+            if (setsockopt(m_socket,SOL_SOCKET,SO_BUSY_POLL,&options.busyPollMicroseconds,sizeof(int)) != 0) {
+                std::cout << "Error setting SO_BUSY_POLL option, error: " << strerror(errno) << std::endl;
+            } else if (setsockopt(m_socket,SOL_SOCKET,SO_PREFER_BUSY_POLL,&yes,sizeof(int)) != 0) {
+                std::cout << "SO_PREFER_BUSY_POLL is not available (" << strerror(errno) << "), busy polling along interrupts" << std::endl;
+            }
+        #else
+            std::cout << "Busy polling is not available on this platform" << std::endl;
+        #endif
+    }
+
+    // Zero copy sends must be allowed on the socket first (Linux 5.0 for UDP)
+    if (options.zeroCopyThreshold > 0) {
+        #ifdef __linux__
+            if (setsockopt(m_socket,SOL_SOCKET,SO_ZEROCOPY,&yes,sizeof(int)) != 0) {
+                std::cout << "Error setting SO_ZEROCOPY option, error: " << strerror(errno) << ", payloads will be copied" << std::endl;
+            } else {
+                m_zeroCopyThreshold = options.zeroCopyThreshold;
+            }
+        #else
+            std::cout << "Zero copy send is not available on this platform" << std::endl;
+        #endif
+    }
+
     // If port is 0, bind anyway so when sending a packet the OS know on which network to send it
     // (in case both networks have the same IP mask (ie 192.168.1.xxx / 255.255.255.0)
     struct SOCKADDR_IN addr;
@@ -68,6 +311,19 @@ DatagramSocket::DatagramSocket(unsigned int interfaceIP, unsigned int port):
         closeSocket();
         return;
     }
+
+    if (options.receiveBackend == DatagramReceiveBackend::IoUring) {
+        #ifdef DATAGRAM_SOCKET_HAS_IO_URING
+            m_uring = new UringReceiver(m_socket,256,65536,RECV_CONTROL_SIZE);
+            if (!m_uring->isInitialized()) {
+                std::cout << "io_uring receive backend unavailable, falling back to socket receive" << std::endl;
+                delete m_uring;
+                m_uring = nullptr;
+            }
+        #else
+            std::cout << "io_uring receive backend is not available on this platform, using socket receive" << std::endl;
+        #endif
+    }
 }
 
 DatagramSocket::~DatagramSocket()
@@ -77,6 +333,11 @@ DatagramSocket::~DatagramSocket()
 
 void DatagramSocket::closeSocket()
 {
+    #ifdef DATAGRAM_SOCKET_HAS_IO_URING
+        delete m_uring;
+        m_uring = nullptr;
+    #endif
+
     if (m_socket != INVALID_SOCKET) {
         close(m_socket);
         m_socket = INVALID_SOCKET;
@@ -88,6 +349,27 @@ bool DatagramSocket::isInitialized()
     return (m_socket != INVALID_SOCKET);
 }
 
+void DatagramSocket::setBufferSize(int option,int forceOption,const char * optionName,int size)
+{
+    if (setsockopt(m_socket,SOL_SOCKET,option,&size,sizeof(size)) != 0) {
+        std::cout << "Error setting " << optionName << " option, error: " << strerror(errno) << std::endl;
+    }
+
+    // The OS silently caps the size (net.core.rmem_max / wmem_max on Linux),
+    // privileged processes can go over this limit with the FORCE variant
+    int actualSize = 0;
+    socklen_t actualSizeLen = sizeof(actualSize);
+    getsockopt(m_socket,SOL_SOCKET,option,&actualSize,&actualSizeLen);
+    if (actualSize < size && forceOption != -1) {
+        if (setsockopt(m_socket,SOL_SOCKET,forceOption,&size,sizeof(size)) == 0) {
+            getsockopt(m_socket,SOL_SOCKET,option,&actualSize,&actualSizeLen);
+        }
+    }
+    if (actualSize < size) {
+        std::cout << "DatagramSocket: " << optionName << " limited to " << actualSize << " bytes instead of " << size << std::endl;
+    }
+}
+
 bool DatagramSocket::joinMulticastGroup(unsigned int ip, unsigned int interfaceIP) {
     int res = 0;
 
@@ -130,6 +412,45 @@ bool DatagramSocket::leaveMulticastGroup(unsigned int ip, unsigned int interface
     return true;
 }
 
+bool DatagramSocket::setMulticastOutput(unsigned int interfaceIP, int ttl, bool loopback) {
+    in_addr interfaceAddr;
+    interfaceAddr.s_addr = htonl(interfaceIP);
+    if (setsockopt(m_socket,IPPROTO_IP,IP_MULTICAST_IF,&interfaceAddr,sizeof(interfaceAddr)) != 0) {
+        std::cout << "Error in DatagramSocket: could not set IP_MULTICAST_IF on interface " << ipIntToStr(interfaceIP) << ", error: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Single byte values are accepted by both Linux and BSD
+    unsigned char ttlValue = static_cast<unsigned char>(std::max(0,std::min(255,ttl)));
+    if (setsockopt(m_socket,IPPROTO_IP,IP_MULTICAST_TTL,&ttlValue,sizeof(ttlValue)) != 0) {
+        std::cout << "Error in DatagramSocket: could not set IP_MULTICAST_TTL, error: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    unsigned char loopValue = loopback ? 1 : 0;
+    if (setsockopt(m_socket,IPPROTO_IP,IP_MULTICAST_LOOP,&loopValue,sizeof(loopValue)) != 0) {
+        std::cout << "Error in DatagramSocket: could not set IP_MULTICAST_LOOP, error: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool DatagramSocket::setPacing(unsigned long long bytesPerSecond,unsigned int burstBytes)
+{
+    m_pacer.configure(bytesPerSecond,burstBytes);
+#ifdef __linux__
+    // Only enforced by the fq qdisc, other qdiscs ignore it and only the pacer applies.
+    // ~0 is unlimited, the 32 bits value is understood by every kernel
+    const unsigned int kernelRate = (bytesPerSecond == 0 || bytesPerSecond >= ~0u) ? ~0u : static_cast<unsigned int>(bytesPerSecond);
+    if (setsockopt(m_socket,SOL_SOCKET,SO_MAX_PACING_RATE,&kernelRate,sizeof(kernelRate)) != 0) {
+        std::cout << "Error in DatagramSocket: could not set SO_MAX_PACING_RATE, error: " << strerror(errno) << std::endl;
+        return false;
+    }
+#endif
+    return true;
+}
+
 bool DatagramSocket::sendBroadcast(unsigned int port,void * buf,unsigned int buflen)
 {
     SOCKADDR_IN to;
@@ -139,10 +460,65 @@ bool DatagramSocket::sendBroadcast(unsigned int port,void * buf,unsigned int buf
     to.sin_port = htons(port);
     bzero(&(to.sin_zero), 8);     /* zero the rest of the struct */
     auto ret = sendto(m_socket,(char*)buf,buflen,0,(sockaddr *) &to, sizeof ( SOCKADDR_IN ));
-    if (ret!=buflen) {
-        std::cout << "Error in DatagramSocket: sendto error: " << strerror(errno) << std::endl;
+    return checkSend(ret,buflen,"sendto",0xFFFFFFFF);
+}
+
+bool DatagramSocket::connectTo(const GenericAddr & addr)
+{
+    if (m_connected && m_connectedAddr.family == addr.family && m_connectedAddr.ip == addr.ip && m_connectedAddr.port == addr.port) {
+        return true;
+    }
+
+    SOCKADDR_IN to;
+    memset(&to,0,sizeof(to));
+    to.sin_family = addr.family;
+    to.sin_addr.s_addr = htonl(addr.ip);
+    to.sin_port = htons(addr.port);
+    if (connect(m_socket,(sockaddr *)&to,sizeof(to)) != 0) {
+        std::cout << "Error in DatagramSocket: connect error: " << strerror(errno) << " on interface " << ipIntToStr(addr.ip) << std::endl;
+        m_connected = false;
+        return false;
+    }
+    m_connected = true;
+    m_connectedAddr = addr;
+    return true;
+}
+
+bool DatagramSocket::useConnection(const GenericAddr & addr)
+{
+    if (!m_connected) {
+        return false;
+    }
+    if (m_connectedAddr.family == addr.family && m_connectedAddr.ip == addr.ip && m_connectedAddr.port == addr.port) {
+        return true;
+    }
+
+    // Destination changed: dissolve the association, datagrams are addressed one by one again
+    SOCKADDR_IN unspec;
+    memset(&unspec,0,sizeof(unspec));
+    unspec.sin_family = AF_UNSPEC;
+    connect(m_socket,(sockaddr *)&unspec,sizeof(unspec));
+    m_connected = false;
+    return false;
+}
+
+bool DatagramSocket::send(const void * buf,unsigned int buflen)
+{
+    if (buflen == 0 || !m_connected) {
+        assert(false);
+        return false;
+    }
+
+    m_pacer.wait(buflen);
+    while (true) {
+        auto res = ::send(m_socket,buf,buflen,0);
+        if (res < 0 && (errno == EINTR || errno == ECONNREFUSED)) {
+            // ECONNREFUSED reports an ICMP port unreachable for an earlier datagram (nobody
+            // listening yet), the error is cleared by reporting it so just send again
+            continue;
+        }
+        return checkSend(res,buflen,"send",m_connectedAddr.ip);
     }
-    return ((unsigned int)ret == buflen);
 }
 
 bool DatagramSocket::sendTo(const GenericAddr & addr,const void *buf,unsigned int buflen)
@@ -152,38 +528,358 @@ bool DatagramSocket::sendTo(const GenericAddr & addr,const void *buf,unsigned in
         return false;
     }
 
+    if (useConnection(addr)) {
+        return send(buf,buflen);
+    }
+
     SOCKADDR_IN to;
     memset(&to,0,sizeof(to));
     to.sin_family = addr.family;
     to.sin_addr.s_addr = htonl(addr.ip);
     to.sin_port = htons(addr.port);
     bzero(&(to.sin_zero), 8);     /* zero the rest of the struct */
+    m_pacer.wait(buflen);
     auto ret = sendto(m_socket,(void *)buf,buflen,0,(sockaddr *)&to,sizeof(sockaddr));
-    if (ret != buflen) {
-        std::cout << "Error in DatagramSocket: sendto error: " << strerror(errno) << " on interface " << ipIntToStr(addr.ip) << std::endl;
+    return checkSend(ret,buflen,"sendto",addr.ip);
+}
+
+bool DatagramSocket::sendTo(const GenericAddr & addr,const DatagramChunk & chunk)
+{
+    if (chunk.headerLen + chunk.payloadLen == 0) {
+        assert(false);
+        return false;
+    }
+
+    const bool connected = useConnection(addr);
+    SOCKADDR_IN to;
+    memset(&to,0,sizeof(to));
+    to.sin_family = addr.family;
+    to.sin_addr.s_addr = htonl(addr.ip);
+    to.sin_port = htons(addr.port);
+
+    iovec iov[2];
+    iov[0].iov_base = const_cast<void*>(chunk.header);
+    iov[0].iov_len = chunk.headerLen;
+    iov[1].iov_base = const_cast<void*>(chunk.payload);
+    iov[1].iov_len = chunk.payloadLen;
+
+    msghdr msg;
+    memset(&msg,0,sizeof(msg));
+    msg.msg_name = connected ? nullptr : &to;
+    msg.msg_namelen = connected ? 0 : sizeof(to);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    const unsigned int len = chunk.headerLen + chunk.payloadLen;
+    m_pacer.wait(len);
+    while (true) {
+        auto res = sendmsg(m_socket,&msg,0);
+        if (res < 0 && (errno == EINTR || (connected && errno == ECONNREFUSED))) {
+            continue;
+        }
+        return checkSend(res,len,"sendmsg",addr.ip);
     }
-    return ((unsigned int)ret == buflen);
 }
 
-bool DatagramSocket::recvFrom(GenericAddr & addr,void * buf,unsigned int & buflen)
+bool DatagramSocket::checkSend(long res,unsigned int expected,const char * call,unsigned int ip)
 {
+    if (res >= 0) {
+        m_counters.countSent(1,static_cast<unsigned long long>(res));
+        if (static_cast<unsigned long>(res) != expected) {
+            m_counters.countShortSend();
+            return false;
+        }
+        return true;
+    }
+    countError(errno,true,call,ip);
+    return false;
+}
+
+void DatagramSocket::countError(int err,bool sending,const char * call,unsigned int ip)
+{
+    m_counters.countError(err,sending,sending && (err == EAGAIN || err == EWOULDBLOCK));
+    unsigned long long suppressed = 0;
+    if (m_counters.shouldLog(suppressed)) {
+        std::cout << "Error in DatagramSocket: " << call << " error: " << strerror(err);
+        if (sending) {
+            std::cout << " on interface " << ipIntToStr(ip);
+        }
+        std::cout << suppressedText(suppressed) << std::endl;
+    }
+}
+
+bool DatagramSocket::sendBatch(const GenericAddr & addr,const DatagramChunk * chunks,unsigned int count)
+{
+    if (count == 0) {
+        assert(false);
+        return false;
+    }
+
+#ifdef __linux__
+    // Connected socket: no destination in messages, the kernel reuses the cached route
+    const bool connected = useConnection(addr);
+    SOCKADDR_IN to;
+    memset(&to,0,sizeof(to));
+    to.sin_family = addr.family;
+    to.sin_addr.s_addr = htonl(addr.ip);
+    to.sin_port = htons(addr.port);
+
+    if (m_sendMessages.size() < count) {
+        m_sendMessages.resize(count);
+        m_sendIovecs.resize(2*count);
+    }
+
+    // Big frames are handed to the kernel without copying headers and payloads
+    int flags = 0;
+    if (m_zeroCopyThreshold > 0) {
+        unsigned long long frameLen = 0;
+        for (unsigned int i=0; i<count; i++) {
+            frameLen += chunks[i].headerLen + chunks[i].payloadLen;
+        }
+        if (frameLen >= m_zeroCopyThreshold) {
+            readZeroCopyCompletions();
+            flags = MSG_ZEROCOPY;
+        }
+    }
+
+    for (unsigned int i=0; i<count; i++) {
+        iovec * iov = &m_sendIovecs[2*i];
+        iov[0].iov_base = const_cast<void*>(chunks[i].header);
+        iov[0].iov_len = chunks[i].headerLen;
+        iov[1].iov_base = const_cast<void*>(chunks[i].payload);
+        iov[1].iov_len = chunks[i].payloadLen;
+
+        msghdr & hdr = m_sendMessages[i].msg_hdr;
+        memset(&hdr,0,sizeof(hdr));
+        hdr.msg_name = connected ? nullptr : &to;
+        hdr.msg_namelen = connected ? 0 : sizeof(to);
+        hdr.msg_iov = iov;
+        hdr.msg_iovlen = 2;
+        m_sendMessages[i].msg_len = 0;
+    }
+
+    // sendmmsg might send less messages than asked, loop until all are sent
+    unsigned int sent = 0;
+    unsigned int paced = 0;
+    while (sent < count) {
+        unsigned int callCount = count - sent;
+        if (m_pacer.enabled()) {
+            // One burst per call, chunks left over by a short send were already paid for
+            if (paced <= sent) {
+                unsigned int bytes = 0;
+                paced = sent;
+                while (paced < count && (paced == sent || bytes + chunks[paced].headerLen + chunks[paced].payloadLen <= m_pacer.burstBytes())) {
+                    bytes += chunks[paced].headerLen + chunks[paced].payloadLen;
+                    paced++;
+                }
+                m_pacer.wait(bytes);
+            }
+            callCount = paced - sent;
+        }
+        auto res = sendmmsg(m_socket,&m_sendMessages[sent],callCount,flags);
+        if (res < 0) {
+            if (errno == EINTR || (connected && errno == ECONNREFUSED)) {
+                continue;
+            }
+            if (errno == ENOBUFS && flags != 0) {
+                // Too much memory pinned by pending zero copy sends, copy the rest of the frame
+                flags = 0;
+                continue;
+            }
+            // A missing chunk invalidates the whole frame on receiver side, don't bother sending the rest
+            countError(errno,true,"sendmmsg",addr.ip);
+            return false;
+        }
+        if (flags != 0) {
+            m_zeroCopyIssued += static_cast<unsigned int>(res);
+        }
+        if (static_cast<unsigned int>(res) < callCount) {
+            m_counters.countShortSend();
+        }
+        unsigned long long bytes = 0;
+        for (int i=0; i<res; i++) {
+            bytes += m_sendMessages[sent + i].msg_len;
+        }
+        m_counters.countSent(static_cast<unsigned long long>(res),bytes);
+        sent += static_cast<unsigned int>(res);
+    }
+    return true;
+#else
+    // No sendmmsg on this platform, send chunks one by one
+    for (unsigned int i=0; i<count; i++) {
+        if (!sendTo(addr,chunks[i])) {
+            return false;
+        }
+    }
+    return true;
+#endif
+}
+
+bool DatagramSocket::sendSegmented(const GenericAddr & addr,const void * buf,unsigned int buflen,unsigned int segmentSize)
+{
+    if (buflen == 0 || segmentSize == 0) {
+        assert(false);
+        return false;
+    }
+
+    const unsigned char * data = static_cast<const unsigned char *>(buf);
+    unsigned int offset = 0;
+
+#ifdef __linux__
+    // The kernel accepts at most 64 segments and a 64KB datagram per call
+    // When pacing, a call sends one burst
+    unsigned int segmentsPerCall = std::min(64u,65507u / segmentSize);
+    if (m_pacer.enabled()) {
+        segmentsPerCall = std::max(1u,std::min(segmentsPerCall,m_pacer.burstBytes() / segmentSize));
+    }
+    if (m_segmentationOffload && segmentsPerCall > 1) {
+        const bool connected = useConnection(addr);
+        int flags = 0;
+        if (m_zeroCopyThreshold > 0 && buflen >= m_zeroCopyThreshold) {
+            readZeroCopyCompletions();
+            flags = MSG_ZEROCOPY;
+        }
+        SOCKADDR_IN to;
+        memset(&to,0,sizeof(to));
+        to.sin_family = addr.family;
+        to.sin_addr.s_addr = htonl(addr.ip);
+        to.sin_port = htons(addr.port);
+
+        while (offset < buflen) {
+            const unsigned int len = std::min(buflen - offset,segmentsPerCall * segmentSize);
+
+            iovec iov;
+            iov.iov_base = const_cast<unsigned char *>(data + offset);
+            iov.iov_len = len;
+
+            char control[CMSG_SPACE(sizeof(uint16_t))];
+            memset(control,0,sizeof(control));
+            m_pacer.wait(len);
+
+            msghdr msg;
+            memset(&msg,0,sizeof(msg));
+            msg.msg_name = connected ? nullptr : &to;
+            msg.msg_namelen = connected ? 0 : sizeof(to);
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            if (len > segmentSize) {
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof(control);
+                cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                const uint16_t gsoSize = static_cast<uint16_t>(segmentSize);
+                memcpy(CMSG_DATA(cmsg),&gsoSize,sizeof(gsoSize));
+            }
+
+            auto res = sendmsg(m_socket,&msg,flags);
+            if (res < 0) {
+                if (errno == EINTR || (connected && errno == ECONNREFUSED)) {
+                    continue;
+                }
+                if (errno == ENOBUFS && flags != 0) {
+                    // Too much memory pinned by pending zero copy sends, copy the rest of the buffer
+                    flags = 0;
+                    continue;
+                }
+                if (errno == EINVAL || errno == EIO || errno == ENOPROTOOPT || errno == EOPNOTSUPP || errno == EMSGSIZE) {
+                    // Old kernel, or segments bigger than the interface MTU (GSO can't fragment):
+                    // send remaining segments one by one from now on
+                    std::cout << "DatagramSocket: UDP segmentation offload unavailable (" << strerror(errno) << "), falling back to one datagram per segment" << std::endl;
+                    m_segmentationOffload = false;
+                    break;
+                }
+                countError(errno,true,"sendmsg",addr.ip);
+                return false;
+            }
+            if (flags != 0) {
+                m_zeroCopyIssued++;
+            }
+            m_counters.countSent((len + segmentSize - 1) / segmentSize,len);
+            offset += len;
+        }
+    }
+#endif
+
+    while (offset < buflen) {
+        const unsigned int len = std::min(buflen - offset,segmentSize);
+        if (!sendTo(addr,data + offset,len)) {
+            return false;
+        }
+        offset += len;
+    }
+    return true;
+}
+
+bool DatagramSocket::recvFrom(GenericAddr & addr,void * buf,unsigned int & buflen,unsigned long long * timestampNs)
+{
+#ifdef __linux__
+    if (m_uring) {
+        DatagramBuffer datagram;
+        datagram.buf = buf;
+        datagram.capacity = buflen;
+        unsigned int received = 0;
+        const bool ok = recvBatchUring(&datagram,1,received);
+        buflen = received > 0 ? datagram.size : 0;
+        addr = datagram.addr;
+        if (timestampNs) {
+            *timestampNs = datagram.timestampNs;
+        }
+        return ok;
+    }
+#endif
+
     SOCKADDR_IN from;
     memset((void*)&from,0,sizeof(from));
+
+#ifdef __linux__
+    // recvmsg instead of recvfrom to get ancillary data (kernel drops)
+    iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = buflen;
+    char control[RECV_CONTROL_SIZE];
+    msghdr hdr;
+    memset(&hdr,0,sizeof(hdr));
+    hdr.msg_name = &from;
+    hdr.msg_namelen = sizeof(from);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    auto res = recvmsg(m_socket,&hdr,0);
+#else
     int from_addr_len = sizeof(from);
     auto res = recvfrom(m_socket,(void*)buf,buflen,0,(sockaddr*)&from,(socklen_t*)&from_addr_len);
+#endif
 
     // we received datas
     if (res > 0) {
-        assert(from_addr_len == sizeof(sockaddr));
         buflen = static_cast<unsigned int>(res);
 
         addr.family = AF_INET;
         addr.ip = ntohl(from.sin_addr.s_addr);
         addr.port = ntohs(from.sin_port);
-        
+
+#ifdef __linux__
+        // Size first: coalesced reads are told apart by a segment size smaller than it
+        DatagramBuffer datagram;
+        datagram.size = buflen;
+        readControlMessages(hdr,datagram);
+        m_counters.countReceived(datagramCount(datagram),buflen);
+        if (timestampNs) {
+            *timestampNs = datagram.timestampNs;
+        }
+#else
+        m_counters.countReceived(1,buflen);
+        if (timestampNs) {
+            *timestampNs = 0;
+        }
+#endif
+
         return true;
     } else {
-        if (errno == EWOULDBLOCK) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR || res == 0) {
             // that's normal for non blocking sockets
             // when there is no data
             buflen = 0;
@@ -191,13 +887,390 @@ bool DatagramSocket::recvFrom(GenericAddr & addr,void * buf,unsigned int & bufle
         }
         else
         {
-            // no datas, no error
+            // no datas, count the error but keep the socket usable
+            countError(errno,false,"recvfrom",0);
             buflen = 0;
             return true;
         }
     }
 }
 
+bool DatagramSocket::waitReadable(int timeoutMicroseconds)
+{
+#ifdef DATAGRAM_SOCKET_HAS_IO_URING
+    if (m_uring) {
+        return m_uring->waitReadable(timeoutMicroseconds);
+    }
+#endif
+
+    pollfd fd;
+    fd.fd = m_socket;
+    fd.events = POLLIN;
+    fd.revents = 0;
+
+    while (true) {
+#ifdef __linux__
+        // ppoll has a nanosecond resolution timeout
+        timespec timeout;
+        timeout.tv_sec = timeoutMicroseconds / 1000000;
+        timeout.tv_nsec = (timeoutMicroseconds % 1000000) * 1000;
+        auto res = ppoll(&fd,1,timeoutMicroseconds < 0 ? nullptr : &timeout,nullptr);
+#else
+        auto res = poll(&fd,1,timeoutMicroseconds < 0 ? -1 : (timeoutMicroseconds + 999) / 1000);
+#endif
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            countError(errno,false,"poll",0);
+            return false;
+        }
+        return res > 0 && (fd.revents & POLLIN);
+    }
+}
+
+bool DatagramSocket::recvBatch(DatagramBuffer * datagrams,unsigned int count,unsigned int & received)
+{
+    received = 0;
+    if (count == 0) {
+        return true;
+    }
+
+#ifdef __linux__
+    if (m_uring) {
+        return recvBatchUring(datagrams,count,received);
+    }
+
+    if (m_recvMessages.size() < count) {
+        m_recvMessages.resize(count);
+        m_recvIovecs.resize(count);
+        m_recvAddrs.resize(count);
+        m_recvControls.resize(count*RECV_CONTROL_SIZE);
+    }
+
+    for (unsigned int i=0; i<count; i++) {
+        m_recvIovecs[i].iov_base = datagrams[i].buf;
+        m_recvIovecs[i].iov_len = datagrams[i].capacity;
+
+        msghdr & hdr = m_recvMessages[i].msg_hdr;
+        memset(&hdr,0,sizeof(hdr));
+        hdr.msg_name = &m_recvAddrs[i];
+        hdr.msg_namelen = sizeof(sockaddr_in);
+        hdr.msg_iov = &m_recvIovecs[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = &m_recvControls[i*RECV_CONTROL_SIZE];
+        hdr.msg_controllen = RECV_CONTROL_SIZE;
+        m_recvMessages[i].msg_len = 0;
+    }
+
+    auto res = recvmmsg(m_socket,&m_recvMessages[0],count,MSG_DONTWAIT,nullptr);
+    if (res < 0) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR) {
+            // that's normal for non blocking sockets
+            // when there is no data
+            return true;
+        }
+        countError(errno,false,"recvmmsg",0);
+        return false;
+    }
+
+    unsigned long long packets = 0;
+    unsigned long long bytes = 0;
+    for (int i=0; i<res; i++) {
+        datagrams[i].size = m_recvMessages[i].msg_len;
+        datagrams[i].addr.family = AF_INET;
+        datagrams[i].addr.ip = ntohl(m_recvAddrs[i].sin_addr.s_addr);
+        datagrams[i].addr.port = ntohs(m_recvAddrs[i].sin_port);
+        readControlMessages(m_recvMessages[i].msg_hdr,datagrams[i]);
+        packets += datagramCount(datagrams[i]);
+        bytes += datagrams[i].size;
+    }
+    m_counters.countReceived(packets,bytes);
+    received = static_cast<unsigned int>(res);
+    return true;
+#else
+    // No recvmmsg on this platform, drain the socket one datagram at a time
+    while (received < count) {
+        DatagramBuffer & datagram = datagrams[received];
+        datagram.size = datagram.capacity;
+        if (!recvFrom(datagram.addr,datagram.buf,datagram.size)) {
+            return false;
+        }
+        if (datagram.size == 0) {
+            break;
+        }
+        datagram.segmentSize = 0;
+        datagram.timestampNs = 0;
+        datagram.hardwareTimestampNs = 0;
+        received++;
+    }
+    return true;
+#endif
+}
+
+unsigned int DatagramSocket::pendingZeroCopySends()
+{
+#ifdef __linux__
+    readZeroCopyCompletions();
+#endif
+    return m_zeroCopyIssued - m_zeroCopyCompleted;
+}
+
+bool DatagramSocket::waitZeroCopyCompletions(int timeoutMicroseconds)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeoutMicroseconds);
+    while (pendingZeroCopySends() > 0) {
+        int timeoutMs = -1;
+        if (timeoutMicroseconds >= 0) {
+            const auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0) {
+                return false;
+            }
+            timeoutMs = static_cast<int>((remaining + 999) / 1000);
+        }
+
+        // Completions are queued on the socket error queue, which is signaled by POLLERR
+        pollfd fd;
+        fd.fd = m_socket;
+        fd.events = 0;
+        fd.revents = 0;
+        if (poll(&fd,1,timeoutMs) < 0 && errno != EINTR) {
+            countError(errno,false,"poll",0);
+            return false;
+        }
+    }
+    return true;
+}
+
+#ifdef __linux__
+void DatagramSocket::readZeroCopyCompletions()
+{
+    while (m_zeroCopyCompleted != m_zeroCopyIssued) {
+        char control[RECV_CONTROL_SIZE];
+        msghdr msg;
+        memset(&msg,0,sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(m_socket,&msg,MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            // Nothing more completed yet
+            return;
+        }
+
+        for (cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg,cmsg)) {
+            if (cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_RECVERR) {
+                continue;
+            }
+            sock_extended_err err;
+            memcpy(&err,CMSG_DATA(cmsg),sizeof(err));
+            if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY || err.ee_errno != 0) {
+                continue;
+            }
+            // Consecutive completions are merged in a single notification: ids ee_info to ee_data
+            const unsigned int completed = err.ee_data - err.ee_info + 1;
+            m_zeroCopyCompleted += completed;
+            if ((err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && m_zeroCopyThreshold > 0) {
+                // Pinning pages and reading the error queue then costs more than the plain copy
+                std::cout << "DatagramSocket: kernel copies zero copy sends (loopback or no scatter-gather on the interface), disabling MSG_ZEROCOPY" << std::endl;
+                m_zeroCopyThreshold = 0;
+            }
+            if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                m_zeroCopyCopied += completed;
+            }
+        }
+    }
+}
+
+void DatagramSocket::readControlMessages(msghdr & hdr,DatagramBuffer & datagram)
+{
+    datagram.segmentSize = 0;
+    datagram.timestampNs = 0;
+    datagram.hardwareTimestampNs = 0;
+    for (cmsghdr * cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&hdr,cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int gsoSize = 0;
+            memcpy(&gsoSize,CMSG_DATA(cmsg),sizeof(gsoSize));
+            // A single datagram can be reported with its own size as segment size
+            if (gsoSize > 0 && static_cast<unsigned int>(gsoSize) < datagram.size) {
+                datagram.segmentSize = static_cast<unsigned int>(gsoSize);
+            }
+        } else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            // Only attached once the socket dropped something
+            uint32_t drops = 0;
+            memcpy(&drops,CMSG_DATA(cmsg),sizeof(drops));
+            m_kernelDrops = drops;
+        } else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            // Software timestamp first (CLOCK_REALTIME), raw hardware timestamp third (adapter clock)
+            timespec stamps[3];
+            memcpy(stamps,CMSG_DATA(cmsg),sizeof(stamps));
+            datagram.timestampNs = static_cast<unsigned long long>(stamps[0].tv_sec) * 1000000000ull + static_cast<unsigned long long>(stamps[0].tv_nsec);
+            datagram.hardwareTimestampNs = static_cast<unsigned long long>(stamps[2].tv_sec) * 1000000000ull + static_cast<unsigned long long>(stamps[2].tv_nsec);
+        } else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            timespec stamp;
+            memcpy(&stamp,CMSG_DATA(cmsg),sizeof(stamp));
+            datagram.timestampNs = static_cast<unsigned long long>(stamp.tv_sec) * 1000000000ull + static_cast<unsigned long long>(stamp.tv_nsec);
+        }
+    }
+    datagram.kernelDrops = m_kernelDrops;
+}
+
+bool DatagramSocket::recvBatchUring(DatagramBuffer * datagrams,unsigned int count,unsigned int & received)
+{
+    received = 0;
+#ifdef DATAGRAM_SOCKET_HAS_IO_URING
+    // Datagrams land in registered buffers without a syscall, copy them in caller buffers
+    // and give registered buffers back to the kernel right away
+    UringReceiver::Datagram datagram;
+    while (received < count && m_uring->next(datagram)) {
+        DatagramBuffer & target = datagrams[received];
+        if (datagram.truncated || datagram.payloadLen > target.capacity) {
+            // Cut to the registered or caller buffer size, a partial chunk is of no use
+            m_uring->release(datagram);
+            countError(EMSGSIZE,false,"io_uring recvmsg",0);
+            continue;
+        }
+        target.size = datagram.payloadLen;
+        memcpy(target.buf,datagram.payload,target.size);
+        target.addr.family = AF_INET;
+        target.addr.ip = ntohl(datagram.from.sin_addr.s_addr);
+        target.addr.port = ntohs(datagram.from.sin_port);
+        readControlMessages(datagram.control,target);
+        m_uring->release(datagram);
+        m_counters.countReceived(datagramCount(target),target.size);
+        received++;
+    }
+    return true;
+#else
+    (void)datagrams;
+    (void)count;
+    return false;
+#endif
+}
+#endif
+
+bool DatagramSocket::setReceiveCoalescing(bool enable)
+{
+#ifdef __linux__
+    int value = enable ? 1 : 0;
+    if (setsockopt(m_socket,SOL_UDP,UDP_GRO,&value,sizeof(value)) != 0) {
+        std::cout << "Error in DatagramSocket: could not set UDP_GRO option, error: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+#else
+    return !enable;
+#endif
+}
+
+bool DatagramSocket::setReusePortSteering(unsigned int socketCount)
+{
+#ifdef __linux__
+    if (socketCount == 0) {
+        return false;
+    }
+
+    // Classic BPF program run by the kernel for each datagram, returning the index of the socket
+    // in the reuseport group. Datagram payload is at offset 0, IP header is read at SKF_NET_OFF
+    const unsigned int ipOffset = static_cast<unsigned int>(SKF_NET_OFF);
+    sock_filter code[] = {
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, ipOffset),              // X = IP header length
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, ipOffset),               // A = UDP source port
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),                            // X = A
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, ipOffset + 12),          // A = IP source address
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),                     // A ^= source port
+        BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x9E3779B1),            // Spread bits before taking the modulo
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, socketCount),
+        BPF_STMT(BPF_RET | BPF_A, 0)
+    };
+    sock_fprog program;
+    program.len = sizeof(code) / sizeof(code[0]);
+    program.filter = code;
+    if (setsockopt(m_socket,SOL_SOCKET,SO_ATTACH_REUSEPORT_CBPF,&program,sizeof(program)) != 0) {
+        std::cout << "Error in DatagramSocket: could not set SO_ATTACH_REUSEPORT_CBPF option, error: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+#else
+    (void)socketCount;
+    return false;
+#endif
+}
+
+bool DatagramSocket::setReceiveFilter(const DatagramFilter & filter)
+{
+#ifdef __linux__
+    // Classic BPF program run by the kernel on each datagram before queueing it, returning 0 drops it.
+    // Data starts at the UDP header, loads past the end of the datagram drop it too.
+    // Every test is followed by its outcome so that jump offsets stay small whatever the list sizes
+    const unsigned int payload = sizeof(udphdr);
+    const unsigned int ipOffset = static_cast<unsigned int>(SKF_NET_OFF);
+    const sock_filter drop = BPF_STMT(BPF_RET | BPF_K, 0);
+    const sock_filter accept = BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF);
+    std::vector<sock_filter> code;
+
+    // Prefix, 4 bytes at a time (loaded in network order) then byte by byte
+    const auto prefix = reinterpret_cast<const unsigned char *>(filter.payloadPrefix.data());
+    const unsigned int prefixLen = static_cast<unsigned int>(filter.payloadPrefix.size());
+    unsigned int offset = 0;
+    for (; offset + 4 <= prefixLen; offset += 4) {
+        const unsigned int word = (prefix[offset] << 24) | (prefix[offset+1] << 16) | (prefix[offset+2] << 8) | prefix[offset+3];
+        code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, payload + offset));
+        code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, word, 1, 0));
+        code.push_back(drop);
+    }
+    for (; offset < prefixLen; offset++) {
+        code.push_back(BPF_STMT(BPF_LD | BPF_B | BPF_ABS, payload + offset));
+        code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, prefix[offset], 1, 0));
+        code.push_back(drop);
+    }
+
+    if (filter.maxByteValue >= 0) {
+        code.push_back(BPF_STMT(BPF_LD | BPF_B | BPF_ABS, payload + filter.maxByteOffset));
+        code.push_back(BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, static_cast<unsigned int>(filter.maxByteValue), 0, 1));
+        code.push_back(drop);
+    }
+
+    // Allowed sources, the first match accepts the datagram
+    if (!filter.sourceIps.empty() || !filter.senderKeys.empty()) {
+        if (!filter.sourceIps.empty()) {
+            code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, ipOffset + 12));
+            for (auto ip: filter.sourceIps) {
+                code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ip, 0, 1));
+                code.push_back(accept);
+            }
+        }
+        if (!filter.senderKeys.empty()) {
+            code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, payload + filter.senderKeyOffset));
+            for (auto key: filter.senderKeys) {
+                const unsigned int swapped = ((key & 0xFF) << 24) | ((key & 0xFF00) << 8) | ((key >> 8) & 0xFF00) | (key >> 24);
+                code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, swapped, 0, 1));
+                code.push_back(accept);
+            }
+        }
+        code.push_back(drop);
+    } else {
+        code.push_back(accept);
+    }
+
+    if (code.size() > BPF_MAXINSNS) {
+        std::cout << "Error in DatagramSocket: receive filter is too long (" << code.size() << " instructions)" << std::endl;
+        return false;
+    }
+
+    sock_fprog program;
+    program.len = static_cast<unsigned short>(code.size());
+    program.filter = &code[0];
+    if (setsockopt(m_socket,SOL_SOCKET,SO_ATTACH_FILTER,&program,sizeof(program)) != 0) {
+        std::cout << "Error in DatagramSocket: could not set SO_ATTACH_FILTER option, error: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+#else
+    (void)filter;
+    return false;
+#endif
+}
+
 #endif
 
 /*********************************************************************************
@@ -208,7 +1281,7 @@ bool DatagramSocket::recvFrom(GenericAddr & addr,void * buf,unsigned int & bufle
 
 #include <cassert>
 
-DatagramSocket::DatagramSocket(unsigned int interfaceIP, unsigned int port)
+DatagramSocket::DatagramSocket(unsigned int interfaceIP, unsigned int port, const DatagramSocketOptions & options)
 {
     m_port = port;
 
@@ -257,11 +1330,18 @@ DatagramSocket::DatagramSocket(unsigned int interfaceIP, unsigned int port)
     }
 
     // increase buffer size
-    int bufLen = 200000;
+    int bufLen = options.receiveBufferSize > 0 ? options.receiveBufferSize : 200000;
     err = setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, (CHAR *)&bufLen, sizeof(bufLen));
     if ( SOCKET_ERROR == err ) {
         std::cout << "Error: Could not set DatagramSocket SO_RCVBUF option" << std::endl;
     }
+    if (options.sendBufferSize > 0) {
+        bufLen = options.sendBufferSize;
+        err = setsockopt(m_socket, SOL_SOCKET, SO_SNDBUF, (CHAR *)&bufLen, sizeof(bufLen));
+        if ( SOCKET_ERROR == err ) {
+            std::cout << "Error: Could not set DatagramSocket SO_SNDBUF option" << std::endl;
+        }
+    }
 
     // If port is 0, bind anyway so when sending a packet the OS know on which network to send it
     // (in case both networks have the same IP mask (ie 192.168.1.xxx / 255.255.255.0)
@@ -370,6 +1450,38 @@ bool DatagramSocket::leaveMulticastGroup(unsigned int ip, unsigned int interface
     return true;
 }
 
+bool DatagramSocket::setMulticastOutput(unsigned int interfaceIP, int ttl, bool loopback) {
+    in_addr interfaceAddr;
+    interfaceAddr.s_addr = htonl(interfaceIP);
+    if (setsockopt(m_socket, IPPROTO_IP, IP_MULTICAST_IF, (char *)&interfaceAddr, sizeof(interfaceAddr)) == SOCKET_ERROR) {
+        int osErr = WSAGetLastError();
+        std::cout << "Error in DatagramSocket: could not set IP_MULTICAST_IF (error " << std::to_string(osErr) << ")" << std::endl;
+        return false;
+    }
+
+    DWORD ttlValue = static_cast<DWORD>((std::max)(0, (std::min)(255, ttl)));
+    if (setsockopt(m_socket, IPPROTO_IP, IP_MULTICAST_TTL, (char *)&ttlValue, sizeof(ttlValue)) == SOCKET_ERROR) {
+        int osErr = WSAGetLastError();
+        std::cout << "Error in DatagramSocket: could not set IP_MULTICAST_TTL (error " << std::to_string(osErr) << ")" << std::endl;
+        return false;
+    }
+
+    DWORD loopValue = loopback ? 1 : 0;
+    if (setsockopt(m_socket, IPPROTO_IP, IP_MULTICAST_LOOP, (char *)&loopValue, sizeof(loopValue)) == SOCKET_ERROR) {
+        int osErr = WSAGetLastError();
+        std::cout << "Error in DatagramSocket: could not set IP_MULTICAST_LOOP (error " << std::to_string(osErr) << ")" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool DatagramSocket::setPacing(unsigned long long bytesPerSecond, unsigned int burstBytes)
+{
+    m_pacer.configure(bytesPerSecond, burstBytes);
+    return true;
+}
+
 bool DatagramSocket::sendBroadcast(unsigned int port, void * buf, unsigned int buflen)
 {
     SOCKADDR_IN target;
@@ -379,39 +1491,166 @@ bool DatagramSocket::sendBroadcast(unsigned int port, void * buf, unsigned int b
     int res = sendto(m_socket,
         (char*)buf,buflen,0,
         (SOCKADDR *) &target, sizeof ( SOCKADDR_IN ));
-    if (res != buflen) {
-        assert(false);
+    return checkSend(res, buflen, "writing");
+}
+
+bool DatagramSocket::connectTo(const GenericAddr & addr)
+{
+    if (m_connected && m_connectedAddr.family == addr.family && m_connectedAddr.ip == addr.ip && m_connectedAddr.port == addr.port) {
+        return true;
+    }
+
+    SOCKADDR_IN target;
+    memset(&target, 0, sizeof(target));
+    target.sin_family = addr.family;
+    target.sin_addr.s_addr = htonl(addr.ip);
+    target.sin_port = htons(addr.port);
+    if (connect(m_socket, (SOCKADDR *) &target, sizeof(SOCKADDR_IN)) == SOCKET_ERROR) {
+        int osErr = WSAGetLastError();
+        std::cout << "Error in DatagramSocket: connect failed (error " << std::to_string(osErr) << ")" << std::endl;
+        m_connected = false;
         return false;
     }
+    m_connected = true;
+    m_connectedAddr = addr;
     return true;
 }
 
+bool DatagramSocket::useConnection(const GenericAddr & addr)
+{
+    if (!m_connected) {
+        return false;
+    }
+    if (m_connectedAddr.family == addr.family && m_connectedAddr.ip == addr.ip && m_connectedAddr.port == addr.port) {
+        return true;
+    }
+
+    // Destination changed: connecting to a zero address dissolves the association
+    SOCKADDR_IN zero;
+    memset(&zero, 0, sizeof(zero));
+    connect(m_socket, (SOCKADDR *) &zero, sizeof(SOCKADDR_IN));
+    m_connected = false;
+    return false;
+}
+
+bool DatagramSocket::send(const void * buf, unsigned int buflen)
+{
+    if (!m_connected) {
+        assert(false);
+        return false;
+    }
+
+    m_pacer.wait(buflen);
+    int res = ::send(m_socket, (const char*) buf, buflen, 0);
+    return checkSend(res, buflen, "writing");
+}
+
 bool DatagramSocket::sendTo(const GenericAddr & addr, const void *buf, unsigned int buflen)
 {
+    if (useConnection(addr)) {
+        return send(buf, buflen);
+    }
+
     SOCKADDR_IN target;
     target.sin_family = addr.family;
     target.sin_addr.s_addr= htonl(addr.ip);
     target.sin_port = htons(addr.port);
+    m_pacer.wait(buflen);
     int res = sendto(m_socket,(char*) buf,buflen,0,(SOCKADDR *) &target, sizeof ( SOCKADDR_IN ));
-    if (res != buflen) {
-        int osErr = WSAGetLastError();
-        if (osErr == WSAEWOULDBLOCK) {
-            // there is nothing on the input
-            return true;
-        } else if (osErr == WSAECONNRESET) {
-            // nothing on the other hand, ignore
-            return true;
-        } else {
-            std::cout << "Error in DatagramSocket: writing failed (error " << std::to_string(osErr) << ")" << std::endl;
+    return checkSend(res, buflen, "writing");
+}
+
+bool DatagramSocket::sendTo(const GenericAddr & addr, const DatagramChunk & chunk)
+{
+    const bool connected = useConnection(addr);
+    SOCKADDR_IN target;
+    memset(&target, 0, sizeof(target));
+    target.sin_family = addr.family;
+    target.sin_addr.s_addr = htonl(addr.ip);
+    target.sin_port = htons(addr.port);
+
+    WSABUF buffers[2];
+    buffers[0].buf = (CHAR *) chunk.header;
+    buffers[0].len = chunk.headerLen;
+    buffers[1].buf = (CHAR *) chunk.payload;
+    buffers[1].len = chunk.payloadLen;
+
+    m_pacer.wait(chunk.headerLen + chunk.payloadLen);
+    DWORD sent = 0;
+    int res = connected ? WSASend(m_socket, buffers, 2, &sent, 0, NULL, NULL)
+                        : WSASendTo(m_socket, buffers, 2, &sent, 0, (SOCKADDR *) &target, sizeof(SOCKADDR_IN), NULL, NULL);
+    return checkSend(res == SOCKET_ERROR ? SOCKET_ERROR : static_cast<int>(sent), chunk.headerLen + chunk.payloadLen, "writing");
+}
+
+bool DatagramSocket::checkSend(int res, unsigned int expected, const char * what)
+{
+    if (res != SOCKET_ERROR) {
+        m_counters.countSent(1, static_cast<unsigned long long>(res));
+        if (static_cast<unsigned int>(res) != expected) {
+            m_counters.countShortSend();
+            return false;
         }
+        return true;
+    }
 
+    int osErr = WSAGetLastError();
+    if (osErr == WSAEWOULDBLOCK) {
+        // Full send queue, the datagram is dropped: count it but don't fail the frame
+        m_counters.countError(osErr, true, true);
+        return true;
+    } else if (osErr == WSAECONNRESET) {
+        // nothing on the other hand, ignore
+        m_counters.countError(osErr, true, false);
+        return true;
+    }
+    countError(osErr, true, what);
+    return false;
+}
+
+void DatagramSocket::countError(int osErr, bool sending, const char * what)
+{
+    m_counters.countError(osErr, sending, false);
+    unsigned long long suppressed = 0;
+    if (m_counters.shouldLog(suppressed)) {
+        std::cout << "Error in DatagramSocket: " << what << " failed (error " << std::to_string(osErr) << ")" << suppressedText(suppressed) << std::endl;
+    }
+}
+
+bool DatagramSocket::sendBatch(const GenericAddr & addr, const DatagramChunk * chunks, unsigned int count)
+{
+    // No batch send API on Windows, send chunks one by one
+    for (unsigned int i = 0; i < count; i++) {
+        if (!sendTo(addr, chunks[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DatagramSocket::sendSegmented(const GenericAddr & addr, const void * buf, unsigned int buflen, unsigned int segmentSize)
+{
+    if (buflen == 0 || segmentSize == 0) {
+        assert(false);
         return false;
     }
+
+    // No segmentation offload on Windows, send segments one by one
+    const unsigned char * data = static_cast<const unsigned char *>(buf);
+    for (unsigned int offset = 0; offset < buflen; offset += segmentSize) {
+        const unsigned int len = (std::min)(buflen - offset, segmentSize);
+        if (!sendTo(addr, data + offset, len)) {
+            return false;
+        }
+    }
     return true;
 }
 
-bool DatagramSocket::recvFrom(GenericAddr& addr, void * buf, unsigned int & buflen)
+bool DatagramSocket::recvFrom(GenericAddr& addr, void * buf, unsigned int & buflen, unsigned long long * timestampNs)
 {
+    if (timestampNs) {
+        *timestampNs = 0;
+    }
+
     SOCKADDR_IN source;
     source.sin_family = AF_INET;
     source.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -431,7 +1670,7 @@ bool DatagramSocket::recvFrom(GenericAddr& addr, void * buf, unsigned int & bufl
             // Ignore this error or we'll get a connection reset after sending a packet to a non existing target
             return true;
         } else {
-            std::cout << "Error in DatagramSocket: reading failed (error " << std::to_string(osErr) << ")" << std::endl;
+            countError(osErr, false, "reading");
         }
 
         return false;
@@ -440,8 +1679,61 @@ bool DatagramSocket::recvFrom(GenericAddr& addr, void * buf, unsigned int & bufl
     addr.family = AF_INET;
     addr.ip = ntohl(source.sin_addr.s_addr);
     addr.port = ntohs(source.sin_port);
+    m_counters.countReceived(1, buflen);
 
     return true;
 }
 
+bool DatagramSocket::waitReadable(int timeoutMicroseconds)
+{
+    WSAPOLLFD fd;
+    fd.fd = m_socket;
+    fd.events = POLLRDNORM;
+    fd.revents = 0;
+    int res = WSAPoll(&fd, 1, timeoutMicroseconds < 0 ? -1 : (timeoutMicroseconds + 999) / 1000);
+    if (res == SOCKET_ERROR) {
+        countError(WSAGetLastError(), false, "polling");
+        return false;
+    }
+    return res > 0 && (fd.revents & POLLRDNORM);
+}
+
+bool DatagramSocket::recvBatch(DatagramBuffer * datagrams, unsigned int count, unsigned int & received)
+{
+    // No batch receive API on Windows, drain the socket one datagram at a time
+    received = 0;
+    while (received < count) {
+        DatagramBuffer & datagram = datagrams[received];
+        datagram.size = datagram.capacity;
+        if (!recvFrom(datagram.addr, datagram.buf, datagram.size)) {
+            return false;
+        }
+        if (datagram.size == 0) {
+            break;
+        }
+        datagram.segmentSize = 0;
+        datagram.timestampNs = 0;
+        datagram.hardwareTimestampNs = 0;
+        received++;
+    }
+    return true;
+}
+
+bool DatagramSocket::setReceiveCoalescing(bool enable)
+{
+    return !enable;
+}
+
+bool DatagramSocket::setReusePortSteering(unsigned int socketCount)
+{
+    (void)socketCount;
+    return false;
+}
+
+bool DatagramSocket::setReceiveFilter(const DatagramFilter & filter)
+{
+    (void)filter;
+    return false;
+}
+
 #endif
@@ -1,12 +1,33 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstdio>
 #include <string>
+#include <utility>
+#include <vector>
 
 inline std::string ipIntToStr(unsigned int ip) {
   return std::to_string((ip >> 24) & 0xFF) + '.' + std::to_string((ip >> 16) & 0xFF) + '.' +
           std::to_string((ip >> 8) & 0xFF) + '.' + std::to_string(ip & 0xFF);
 }
 
+// Parse a dotted IPv4 address ("239.255.55.83"), returns false when malformed
+inline bool ipStrToInt(const std::string & str, unsigned int & ip) {
+  unsigned int bytes[4];
+  char end;
+  if (sscanf(str.c_str(), "%u.%u.%u.%u%c", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &end) != 4 ||
+      bytes[0] > 255 || bytes[1] > 255 || bytes[2] > 255 || bytes[3] > 255) {
+    return false;
+  }
+  ip = (bytes[0] << 24) + (bytes[1] << 16) + (bytes[2] << 8) + bytes[3];
+  return true;
+}
+
+inline bool isMulticastIp(unsigned int ip) {
+  return (ip >> 28) == 0xE; // 224.0.0.0/4
+}
+
 struct GenericAddr
 {
     short 			family = 0;
@@ -14,6 +35,150 @@ struct GenericAddr
     unsigned short 	port = 0;
 };
 
+// One slot of a caller-owned receive ring used by DatagramSocket::recvBatch
+// buf / capacity are provided by the caller, size / addr are filled on reception
+struct DatagramBuffer
+{
+    void *          buf = nullptr;
+    unsigned int    capacity = 0;
+    unsigned int    size = 0;
+    GenericAddr     addr;
+    // Non zero when the kernel coalesced several datagrams in buf (receive coalescing):
+    // buf then holds back to back datagrams of segmentSize bytes, the last one can be shorter
+    unsigned int    segmentSize = 0;
+    // Cumulative count of datagrams dropped because the socket receive queue was full
+    // (only updated when DatagramSocketOptions::reportKernelDrops is set, Linux only)
+    unsigned int    kernelDrops = 0;
+    // Kernel arrival time in nanoseconds since epoch (CLOCK_REALTIME, comparable to system_clock),
+    // 0 when unavailable (needs DatagramSocketOptions::receiveTimestamps)
+    unsigned long long timestampNs = 0;
+    // Arrival time stamped by the network adapter when it supports it, else 0. In the adapter clock
+    // (PTP hardware clock), only comparable to other hardware timestamps of the same adapter
+    unsigned long long hardwareTimestampNs = 0;
+};
+
+// A datagram made of a header followed by a payload, both sent by
+// DatagramSocket::sendBatch without being copied together first
+struct DatagramChunk
+{
+    const void *    header = nullptr;
+    unsigned int    headerLen = 0;
+    const void *    payload = nullptr;
+    unsigned int    payloadLen = 0;
+};
+
+// Datagrams accepted by DatagramSocket::setReceiveFilter, anything else is dropped by the kernel
+// before reaching the socket. Offsets are in the datagram payload, too short datagrams are dropped
+struct DatagramFilter
+{
+    std::string                 payloadPrefix;          // Payload must start with these bytes
+    int                         maxByteValue = -1;      // When >= 0, byte at maxByteOffset must not be greater
+    unsigned int                maxByteOffset = 0;
+    // Datagrams must come from one of sourceIps or carry one of senderKeys (32 bits little endian
+    // value at senderKeyOffset), both empty accepts any source
+    std::vector<unsigned int>   sourceIps;
+    std::vector<unsigned int>   senderKeys;
+    unsigned int                senderKeyOffset = 0;
+};
+
+// How a DatagramSocket receives datagrams
+enum class DatagramReceiveBackend
+{
+    Socket,     // recvfrom / recvmmsg
+    IoUring     // io_uring multishot recvmsg into registered buffers, Linux only (falls back to Socket)
+};
+
+// Optional settings applied when creating a DatagramSocket
+struct DatagramSocketOptions
+{
+    int     receiveBufferSize = 0;      // SO_RCVBUF in bytes, 0 keeps the OS default
+    int     sendBufferSize = 0;         // SO_SNDBUF in bytes, 0 keeps the OS default
+    bool    reportKernelDrops = false;  // SO_RXQ_OVFL, Linux only
+    bool    receiveTimestamps = false;  // SO_TIMESTAMPING or SO_TIMESTAMPNS, Linux only
+    DatagramReceiveBackend receiveBackend = DatagramReceiveBackend::Socket;
+    // Send calls of at least this many bytes (a whole frame for sendBatch / sendSegmented) use
+    // MSG_ZEROCOPY: the kernel reads user buffers instead of copying them, so buffers must stay
+    // untouched until waitZeroCopyCompletions returns. 0 disables, Linux only
+    // Turned off by the socket when the kernel reports copying anyway (ie loopback)
+    unsigned int zeroCopyThreshold = 0;
+    // SO_BUSY_POLL: reads spin on the network adapter queue for up to this many microseconds
+    // instead of waiting for its interrupt, preferred over interrupts when the kernel supports
+    // SO_PREFER_BUSY_POLL. Trades CPU for latency, 0 disables, Linux only
+    int     busyPollMicroseconds = 0;
+};
+
+// Snapshot of a DatagramSocket counters, see DatagramSocket::stats
+struct DatagramSocketStats
+{
+    unsigned long long  packetsSent = 0;
+    unsigned long long  bytesSent = 0;
+    unsigned long long  packetsReceived = 0;    // Coalesced datagrams count once per segment
+    unsigned long long  bytesReceived = 0;
+    unsigned long long  sendErrors = 0;         // Failed send calls, would block included
+    unsigned long long  sendWouldBlock = 0;     // Send buffer full (EAGAIN / WSAEWOULDBLOCK), datagrams were not sent
+    unsigned long long  shortSends = 0;         // Calls that sent less datagrams or bytes than asked
+    unsigned long long  receiveErrors = 0;
+    int                 lastError = 0;          // errno, WSA error code on Windows
+    unsigned long long  lastErrorTimeNs = 0;    // System clock, nanoseconds since epoch
+    std::vector<std::pair<int,unsigned long long>> errorsByCode;    // Failed calls for each error code seen
+};
+
+// Counters behind DatagramSocketStats. Relaxed atomics: another thread (ie an UI) can take
+// snapshots without slowing down the sending or receiving thread
+class DatagramSocketCounters
+{
+public:
+    void countSent(unsigned long long packets,unsigned long long bytes);
+    void countReceived(unsigned long long packets,unsigned long long bytes);
+    void countShortSend();
+    // Count a failed call, code is an errno or WSA error code
+    void countError(int code,bool sending,bool wouldBlock);
+    // Rate limit error logs: returns true at most once per second, and sets suppressed to the
+    // number of calls that returned false since then
+    bool shouldLog(unsigned long long & suppressed);
+    DatagramSocketStats snapshot() const;
+
+private:
+    // Error codes are counted in a fixed table, WSA codes are offset by WSABASEERR
+    static const int ErrorCodeCount = 256;
+
+    std::atomic<unsigned long long> m_packetsSent{0};
+    std::atomic<unsigned long long> m_bytesSent{0};
+    std::atomic<unsigned long long> m_packetsReceived{0};
+    std::atomic<unsigned long long> m_bytesReceived{0};
+    std::atomic<unsigned long long> m_sendErrors{0};
+    std::atomic<unsigned long long> m_sendWouldBlock{0};
+    std::atomic<unsigned long long> m_shortSends{0};
+    std::atomic<unsigned long long> m_receiveErrors{0};
+    std::atomic<int>                m_lastError{0};
+    std::atomic<unsigned long long> m_lastErrorTimeNs{0};
+    std::atomic<unsigned long long> m_errorsByCode[ErrorCodeCount + 1] = {};   // Last one counts codes out of the table
+    std::atomic<unsigned long long> m_lastLogTimeNs{0};
+    std::atomic<unsigned long long> m_suppressedLogs{0};
+};
+
+// Token bucket spreading sends over time: at most burstBytes leave back to back, then sends
+// wait so the average rate stays at bytesPerSecond. Sends block the calling thread
+class DatagramPacer
+{
+public:
+    // 0 bytes per second disables pacing
+    void configure(unsigned long long bytesPerSecond,unsigned int burstBytes);
+    bool enabled() const { return m_bytesPerSecond > 0; }
+    unsigned int burstBytes() const { return m_burstBytes; }
+    // Block until bytes can be sent. A send bigger than the burst waits for a full bucket
+    // and the following ones pay for the excess
+    void wait(unsigned int bytes);
+
+private:
+    void refill(std::chrono::steady_clock::time_point now);
+
+    unsigned long long m_bytesPerSecond = 0;
+    unsigned int m_burstBytes = 0;
+    double m_tokens = 0;
+    std::chrono::steady_clock::time_point m_lastRefill;
+};
+
 /*********************************************************************************
   UNIX version
 *********************************************************************************/
@@ -37,32 +202,132 @@ struct GenericAddr
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <netdb.h> // get host by name
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
 
+class UringReceiver;
+
 class DatagramSocket
 {
 public:
-    DatagramSocket(unsigned int interfaceIP, unsigned int port);
+    DatagramSocket(unsigned int interfaceIP, unsigned int port, const DatagramSocketOptions & options = DatagramSocketOptions());
     ~DatagramSocket();
 
     bool joinMulticastGroup(unsigned int ip, unsigned int interfaceIP);
     bool leaveMulticastGroup(unsigned int ip, unsigned int interfaceIP);
+    // Settings for datagrams sent to multicast groups: outgoing interface (0 lets the OS route),
+    // TTL (1 stays on the local network) and whether they are looped back to this host
+    bool setMulticastOutput(unsigned int interfaceIP, int ttl, bool loopback);
+    // Pace sends at bytesPerSecond with bursts of at most burstBytes (see DatagramPacer), 0 bytes
+    // per second disables it. Batches are split in bursts, so a frame no longer leaves as a single
+    // burst of datagrams. On Linux the rate is also given to the kernel (SO_MAX_PACING_RATE): with
+    // the fq qdisc, datagrams inside a burst are spaced too
+    bool setPacing(unsigned long long bytesPerSecond,unsigned int burstBytes);
 
     bool sendBroadcast(unsigned int port,void * buf,unsigned int buflen);
 
+    // Connect the socket to a fixed destination: send, and sends to this same address, then skip
+    // per datagram address handling and route lookup. Sending to another address disconnects it
+    // A connected socket only receives datagrams coming from the connected address
+    bool connectTo(const GenericAddr & addr);
+    // Send a datagram to the address given to connectTo
+    bool send(const void * buf,unsigned int buflen);
+
     bool sendTo(const GenericAddr & addr,const void *buf,unsigned int buflen);
-    bool recvFrom(GenericAddr & addr,void * buf,unsigned int & buflen);
+    // Send a single chunk as one datagram, header and payload are gathered by the kernel (no copy)
+    bool sendTo(const GenericAddr & addr,const DatagramChunk & chunk);
+    // Send count datagrams to the same destination in a single call (sendmmsg on Linux)
+    bool sendBatch(const GenericAddr & addr,const DatagramChunk * chunks,unsigned int count);
+    // Send a buffer of back to back segments of segmentSize bytes (the last one can be shorter),
+    // each segment being a datagram on the wire. On Linux, the kernel does the split (UDP_SEGMENT)
+    bool sendSegmented(const GenericAddr & addr,const void * buf,unsigned int buflen,unsigned int segmentSize);
+    // When timestampNs is given, it receives the kernel arrival time (see DatagramBuffer::timestampNs)
+    bool recvFrom(GenericAddr & addr,void * buf,unsigned int & buflen,unsigned long long * timestampNs = nullptr);
+    // Receive up to count datagrams in a single call (recvmmsg on Linux)
+    // received is set to the number of filled buffers, zero when there is no data
+    bool recvBatch(DatagramBuffer * datagrams,unsigned int count,unsigned int & received);
+    // Let the kernel coalesce datagrams from the same flow (UDP_GRO, Linux only)
+    // Coalesced datagrams are only reported by recvBatch, use it instead of recvFrom when enabled
+    bool setReceiveCoalescing(bool enable);
+    // For socketCount sockets bound to the same port (SO_REUSEPORT), always deliver datagrams from
+    // a given source address and port to the same socket, picked in bind order (Linux only)
+    // Only needs to be called on one socket of the group
+    bool setReusePortSteering(unsigned int socketCount);
+    // Drop datagrams not matching filter in the kernel (SO_ATTACH_FILTER, Linux only), they
+    // then never wake a thread waiting on this socket
+    bool setReceiveFilter(const DatagramFilter & filter);
+    // Block until a datagram can be read or timeout is elapsed (negative timeout waits forever)
+    // Returns false on timeout
+    bool waitReadable(int timeoutMicroseconds);
 
     bool isInitialized();
 
+    // Cumulative count of datagrams dropped by the kernel because the receive queue was full,
+    // as reported by the last received datagram (needs DatagramSocketOptions::reportKernelDrops)
+    unsigned int kernelDropCount() const { return m_kernelDrops; }
+
+    // Packets, bytes and errors counted since the socket was created, safe to call from any thread
+    DatagramSocketStats stats() const { return m_counters.snapshot(); }
+
+    // Number of zero copy send calls whose buffers are still in use by the kernel
+    unsigned int pendingZeroCopySends();
+    // Block until the kernel released every buffer given to a zero copy send, buffers can then be
+    // modified or freed. Returns false on timeout (negative timeout waits forever)
+    bool waitZeroCopyCompletions(int timeoutMicroseconds);
+    // Zero copy sends the kernel completed by copying anyway (loopback, adapter without scatter-gather)
+    unsigned int zeroCopyCopiedCount() const { return m_zeroCopyCopied; }
+
 private:
     void closeSocket();
+    void setBufferSize(int option,int forceOption,const char * optionName,int size);
+    // True when connected to addr, otherwise drop any connection so addr can be given to the kernel
+    bool useConnection(const GenericAddr & addr);
+    // Count the result of a single datagram send call, true when all bytes were sent
+    bool checkSend(long res,unsigned int expected,const char * call,unsigned int ip);
+    // Count a failed call and log it, rate limited
+    void countError(int err,bool sending,const char * call,unsigned int ip);
 
     int m_port=0;
     SOCKET m_socket = INVALID_SOCKET;
+    unsigned int m_kernelDrops = 0;
+    DatagramSocketCounters m_counters;
+    DatagramPacer m_pacer;
+
+    bool m_connected = false;
+    GenericAddr m_connectedAddr;
+
+    // MSG_ZEROCOPY state, every zero copy send call gets the next id from the kernel
+    // Threshold is reset to 0 once the kernel reports it copied data anyway
+    unsigned int m_zeroCopyThreshold = 0;
+    unsigned int m_zeroCopyIssued = 0;
+    unsigned int m_zeroCopyCompleted = 0;
+    unsigned int m_zeroCopyCopied = 0;
+
+    #ifdef __linux__
+        void readZeroCopyCompletions();
+
+        // Scratch structures for recvmmsg, kept to avoid allocating on each call
+        std::vector<mmsghdr>        m_recvMessages;
+        std::vector<iovec>          m_recvIovecs;
+        std::vector<sockaddr_in>    m_recvAddrs;
+        std::vector<char>           m_recvControls;
+
+        void readControlMessages(msghdr & hdr,DatagramBuffer & datagram);
+        bool recvBatchUring(DatagramBuffer * datagrams,unsigned int count,unsigned int & received);
+
+        // Set when receiving through io_uring (DatagramReceiveBackend::IoUring)
+        UringReceiver *             m_uring = nullptr;
+
+        // Scratch structures for sendmmsg (two iovecs per message: header and payload)
+        std::vector<mmsghdr>        m_sendMessages;
+        std::vector<iovec>          m_sendIovecs;
+
+        // Cleared when the kernel refuses UDP_SEGMENT, segments are then sent one by one
+        bool                        m_segmentationOffload = true;
+    #endif
 };
 
 #endif
@@ -81,25 +346,78 @@ private:
 class DatagramSocket
 {
 public:
-    DatagramSocket(unsigned int interfaceIP, unsigned int port);
+    DatagramSocket(unsigned int interfaceIP, unsigned int port, const DatagramSocketOptions & options = DatagramSocketOptions());
 
     ~DatagramSocket();
 
     bool joinMulticastGroup(unsigned int ip, unsigned int interfaceIP);
     bool leaveMulticastGroup(unsigned int ip, unsigned int interfaceIP);
+    // Settings for datagrams sent to multicast groups: outgoing interface (0 lets the OS route),
+    // TTL (1 stays on the local network) and whether they are looped back to this host
+    bool setMulticastOutput(unsigned int interfaceIP, int ttl, bool loopback);
+    // Pace sends at bytesPerSecond with bursts of at most burstBytes (see DatagramPacer), 0 bytes
+    // per second disables it. No kernel pacing on Windows, sends wait in the calling thread
+    bool setPacing(unsigned long long bytesPerSecond, unsigned int burstBytes);
 
     bool sendBroadcast(unsigned int port, void * buf, unsigned int buflen);
 
+    // Connect the socket to a fixed destination: send, and sends to this same address, then skip
+    // per datagram address handling. Sending to another address disconnects it
+    bool connectTo(const GenericAddr & addr);
+    // Send a datagram to the address given to connectTo
+    bool send(const void * buf, unsigned int buflen);
+
     bool sendTo(const GenericAddr & addr, const void *buf, unsigned int buflen);
-    bool recvFrom(GenericAddr & addr, void * buf, unsigned int & buflen);
+    // Send a single chunk as one datagram, header and payload are gathered by WSASendTo (no copy)
+    bool sendTo(const GenericAddr & addr, const DatagramChunk & chunk);
+    // Send count datagrams to the same destination
+    bool sendBatch(const GenericAddr & addr, const DatagramChunk * chunks, unsigned int count);
+    // Send a buffer of back to back segments of segmentSize bytes (the last one can be shorter),
+    // each segment being a datagram on the wire
+    bool sendSegmented(const GenericAddr & addr, const void * buf, unsigned int buflen, unsigned int segmentSize);
+    // Kernel timestamps are not available on Windows, timestampNs is always set to 0
+    bool recvFrom(GenericAddr & addr, void * buf, unsigned int & buflen, unsigned long long * timestampNs = nullptr);
+    // Receive up to count datagrams, received is set to the number of filled buffers
+    bool recvBatch(DatagramBuffer * datagrams, unsigned int count, unsigned int & received);
+    // Receive coalescing is not supported on Windows, always returns false when enabling
+    bool setReceiveCoalescing(bool enable);
+    // SO_REUSEPORT groups are not supported on Windows, always returns false
+    bool setReusePortSteering(unsigned int socketCount);
+    // Kernel filtering is not available on Windows, always returns false
+    bool setReceiveFilter(const DatagramFilter & filter);
+    // Block until a datagram can be read or timeout is elapsed (negative timeout waits forever)
+    // Returns false on timeout
+    bool waitReadable(int timeoutMicroseconds);
 
     bool isInitialized();
 
+    // Kernel drop reporting is not available on Windows, always returns 0
+    unsigned int kernelDropCount() const { return 0; }
+
+    // Packets, bytes and errors counted since the socket was created, safe to call from any thread
+    DatagramSocketStats stats() const { return m_counters.snapshot(); }
+
+    // Zero copy sends are not available on Windows, nothing is ever pending
+    unsigned int pendingZeroCopySends() { return 0; }
+    bool waitZeroCopyCompletions(int timeoutMicroseconds) { (void)timeoutMicroseconds; return true; }
+    unsigned int zeroCopyCopiedCount() const { return 0; }
+
 private:
     void closeSocket();
+    // True when connected to addr, otherwise drop any connection so addr can be given to sendto
+    bool useConnection(const GenericAddr & addr);
+    // Count the result of a single datagram send call, true when all bytes were sent
+    bool checkSend(int res,unsigned int expected,const char * what);
+    // Count a failed call and log it, rate limited
+    void countError(int osErr,bool sending,const char * what);
 
     int m_port = 0;
     SOCKET m_socket = INVALID_SOCKET;
+    DatagramSocketCounters m_counters;
+    DatagramPacer m_pacer;
+
+    bool m_connected = false;
+    GenericAddr m_connectedAddr;
 };
 
 #endif
@@ -0,0 +1,332 @@
+#include "UringReceiver.h"
+
+#ifdef DATAGRAM_SOCKET_HAS_IO_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <iostream>
+#include "errno.h"
+
+// User data of the multishot recvmsg request
+#define URING_RECV_USER_DATA 1
+
+static int uringSetup(unsigned entries,io_uring_params * params)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup,entries,params));
+}
+
+static int uringEnter(int ringFd,unsigned toSubmit,unsigned minComplete,unsigned flags,const void * arg,size_t argSize)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter,ringFd,toSubmit,minComplete,flags,arg,argSize));
+}
+
+static int uringRegister(int ringFd,unsigned opcode,const void * arg,unsigned argCount)
+{
+    return static_cast<int>(syscall(__NR_io_uring_register,ringFd,opcode,arg,argCount));
+}
+
+UringReceiver::UringReceiver(int socket,unsigned int bufferCount,unsigned int payloadCapacity,unsigned int controlCapacity):
+    m_socket(socket)
+{
+    // Buffer ring size must be a power of two
+    m_bufferCount = 1;
+    while (m_bufferCount < bufferCount && m_bufferCount < 32768) {
+        m_bufferCount *= 2;
+    }
+
+    // Each buffer receives an io_uring_recvmsg_out header, the source address, ancillary data and the payload
+    memset(&m_msgTemplate,0,sizeof(m_msgTemplate));
+    m_msgTemplate.msg_namelen = sizeof(sockaddr_in);
+    m_msgTemplate.msg_controllen = controlCapacity;
+    m_bufferSize = static_cast<unsigned int>(sizeof(io_uring_recvmsg_out)) + m_msgTemplate.msg_namelen + controlCapacity + payloadCapacity;
+    m_bufferSize = (m_bufferSize + 63) & ~63u;
+
+    if (!setupRing() || !setupBufferRing()) {
+        closeRing();
+        return;
+    }
+
+    if (!armReceive()) {
+        closeRing();
+        return;
+    }
+}
+
+UringReceiver::~UringReceiver()
+{
+    closeRing();
+}
+
+bool UringReceiver::setupRing()
+{
+    io_uring_params params;
+    memset(&params,0,sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = 2 * m_bufferCount;
+
+    m_ringFd = uringSetup(8,&params);
+    if (m_ringFd < 0) {
+        std::cout << "Error in UringReceiver: io_uring_setup error: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        std::cout << "Error in UringReceiver: kernel is too old (no IORING_FEAT_EXT_ARG)" << std::endl;
+        return false;
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        m_sqRingSize = std::max(m_sqRingSize,m_cqRingSize);
+        m_cqRingSize = 0;
+    }
+
+    m_sqRing = mmap(nullptr,m_sqRingSize,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,m_ringFd,IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        std::cout << "Error in UringReceiver: could not map submission ring: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (m_cqRingSize > 0) {
+        m_cqRing = mmap(nullptr,m_cqRingSize,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,m_ringFd,IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+            std::cout << "Error in UringReceiver: could not map completion ring: " << strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void * sqes = mmap(nullptr,m_sqesSize,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,m_ringFd,IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        std::cout << "Error in UringReceiver: could not map submission entries: " << strerror(errno) << std::endl;
+        return false;
+    }
+    m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+    unsigned char * sq = static_cast<unsigned char *>(m_sqRing);
+    unsigned char * cq = m_cqRing ? static_cast<unsigned char *>(m_cqRing) : sq;
+    m_sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    m_sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    m_sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    m_sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    m_cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    m_cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    return true;
+}
+
+bool UringReceiver::setupBufferRing()
+{
+    m_bufRingSize = m_bufferCount * sizeof(io_uring_buf);
+    void * bufRing = mmap(nullptr,m_bufRingSize,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+    if (bufRing == MAP_FAILED) {
+        std::cout << "Error in UringReceiver: could not allocate buffer ring: " << strerror(errno) << std::endl;
+        return false;
+    }
+    m_bufRing = static_cast<io_uring_buf_ring *>(bufRing);
+
+    m_buffersSize = static_cast<size_t>(m_bufferCount) * m_bufferSize;
+    void * buffers = mmap(nullptr,m_buffersSize,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,-1,0);
+    if (buffers == MAP_FAILED) {
+        std::cout << "Error in UringReceiver: could not allocate receive buffers: " << strerror(errno) << std::endl;
+        return false;
+    }
+    m_buffers = static_cast<unsigned char *>(buffers);
+
+    io_uring_buf_reg reg;
+    memset(&reg,0,sizeof(reg));
+    reg.ring_addr = reinterpret_cast<unsigned long long>(m_bufRing);
+    reg.ring_entries = m_bufferCount;
+    reg.bgid = 0;
+    if (uringRegister(m_ringFd,IORING_REGISTER_PBUF_RING,&reg,1) < 0) {
+        std::cout << "Error in UringReceiver: could not register buffer ring: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Hand all buffers to the kernel
+    for (unsigned int i=0; i<m_bufferCount; i++) {
+        Datagram datagram;
+        datagram.bufferId = static_cast<unsigned short>(i);
+        release(datagram);
+    }
+    return true;
+}
+
+bool UringReceiver::armReceive()
+{
+    const unsigned tail = *m_sqTail;
+    const unsigned index = tail & m_sqMask;
+    io_uring_sqe * sqe = &m_sqes[index];
+    memset(sqe,0,sizeof(*sqe));
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = m_socket;
+    sqe->addr = reinterpret_cast<unsigned long long>(&m_msgTemplate);
+    sqe->len = 1;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = URING_RECV_USER_DATA;
+    m_sqArray[index] = index;
+    __atomic_store_n(m_sqTail,tail + 1,__ATOMIC_RELEASE);
+
+    while (true) {
+        const int res = uringEnter(m_ringFd,1,0,0,nullptr,0);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cout << "Error in UringReceiver: could not submit receive request: " << strerror(errno) << std::endl;
+            return false;
+        }
+        break;
+    }
+    m_armed = true;
+    return true;
+}
+
+void UringReceiver::closeRing()
+{
+    if (m_ringFd >= 0) {
+        close(m_ringFd);
+        m_ringFd = -1;
+    }
+    if (m_sqes) {
+        munmap(m_sqes,m_sqesSize);
+        m_sqes = nullptr;
+    }
+    if (m_cqRing) {
+        munmap(m_cqRing,m_cqRingSize);
+        m_cqRing = nullptr;
+    }
+    if (m_sqRing) {
+        munmap(m_sqRing,m_sqRingSize);
+        m_sqRing = nullptr;
+    }
+    if (m_buffers) {
+        munmap(m_buffers,m_buffersSize);
+        m_buffers = nullptr;
+    }
+    if (m_bufRing) {
+        munmap(m_bufRing,m_bufRingSize);
+        m_bufRing = nullptr;
+    }
+}
+
+bool UringReceiver::next(Datagram & datagram)
+{
+    if (m_ringFd < 0) {
+        return false;
+    }
+
+    // The multishot request stops when it runs out of buffers, rearm it
+    if (!m_armed && !armReceive()) {
+        return false;
+    }
+
+    while (true) {
+        const unsigned head = *m_cqHead;
+        const unsigned tail = __atomic_load_n(m_cqTail,__ATOMIC_ACQUIRE);
+        if (head == tail) {
+            return false;
+        }
+
+        const io_uring_cqe & cqe = m_cqes[head & m_cqMask];
+        const int res = cqe.res;
+        const unsigned flags = cqe.flags;
+        __atomic_store_n(m_cqHead,head + 1,__ATOMIC_RELEASE);
+
+        if (!(flags & IORING_CQE_F_MORE)) {
+            m_armed = false;
+        }
+        if (res < 0) {
+            // ENOBUFS: all buffers are held by the application, request is rearmed on next call
+            if (res != -ENOBUFS) {
+                std::cout << "Error in UringReceiver: recvmsg error: " << strerror(-res) << std::endl;
+            }
+            continue;
+        }
+        if (!(flags & IORING_CQE_F_BUFFER)) {
+            continue;
+        }
+
+        const unsigned short bufferId = static_cast<unsigned short>(flags >> IORING_CQE_BUFFER_SHIFT);
+        unsigned char * buffer = m_buffers + static_cast<size_t>(bufferId) * m_bufferSize;
+        io_uring_recvmsg_out out;
+        memcpy(&out,buffer,sizeof(out));
+
+        unsigned char * name = buffer + sizeof(io_uring_recvmsg_out);
+        unsigned char * control = name + m_msgTemplate.msg_namelen;
+        unsigned char * payload = control + m_msgTemplate.msg_controllen;
+        const unsigned int headersSize = static_cast<unsigned int>(payload - buffer);
+
+        memset(&datagram.from,0,sizeof(datagram.from));
+        memcpy(&datagram.from,name,std::min<size_t>(out.namelen,sizeof(datagram.from)));
+        memset(&datagram.control,0,sizeof(datagram.control));
+        datagram.control.msg_control = control;
+        datagram.control.msg_controllen = std::min<size_t>(out.controllen,m_msgTemplate.msg_controllen);
+        datagram.payload = payload;
+        datagram.payloadLen = std::min(out.payloadlen,static_cast<unsigned int>(res) > headersSize ? static_cast<unsigned int>(res) - headersSize : 0u);
+        datagram.truncated = (out.flags & MSG_TRUNC) != 0;
+        datagram.bufferId = bufferId;
+        return true;
+    }
+}
+
+void UringReceiver::release(const Datagram & datagram)
+{
+    // Entries start at the beginning of the ring: in C++ the bufs flexible array member of
+    // io_uring_buf_ring is shifted by the empty struct the kernel header puts in front of it
+    io_uring_buf * bufs = reinterpret_cast<io_uring_buf *>(m_bufRing);
+    io_uring_buf & buf = bufs[m_bufRingTail & (m_bufferCount - 1)];
+    buf.addr = reinterpret_cast<unsigned long long>(m_buffers + static_cast<size_t>(datagram.bufferId) * m_bufferSize);
+    buf.len = m_bufferSize;
+    buf.bid = datagram.bufferId;
+    m_bufRingTail++;
+    __atomic_store_n(&m_bufRing->tail,m_bufRingTail,__ATOMIC_RELEASE);
+}
+
+bool UringReceiver::waitReadable(int timeoutMicroseconds)
+{
+    if (m_ringFd < 0) {
+        return false;
+    }
+    if (!m_armed && !armReceive()) {
+        return false;
+    }
+
+    while (true) {
+        if (*m_cqHead != __atomic_load_n(m_cqTail,__ATOMIC_ACQUIRE)) {
+            return true;
+        }
+
+        __kernel_timespec timeout;
+        timeout.tv_sec = timeoutMicroseconds / 1000000;
+        timeout.tv_nsec = (timeoutMicroseconds % 1000000) * 1000;
+        io_uring_getevents_arg arg;
+        memset(&arg,0,sizeof(arg));
+        arg.ts = reinterpret_cast<unsigned long long>(&timeout);
+
+        int res;
+        if (timeoutMicroseconds < 0) {
+            res = uringEnter(m_ringFd,0,1,IORING_ENTER_GETEVENTS,nullptr,0);
+        } else {
+            res = uringEnter(m_ringFd,0,1,IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,&arg,sizeof(arg));
+        }
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != ETIME) {
+                std::cout << "Error in UringReceiver: io_uring_enter error: " << strerror(errno) << std::endl;
+            }
+        }
+        return *m_cqHead != __atomic_load_n(m_cqTail,__ATOMIC_ACQUIRE);
+    }
+}
+
+#endif
@@ -0,0 +1,94 @@
+#pragma once
+
+/*
+ *  io_uring receive engine used by DatagramSocket when DatagramSocketOptions::receiveBackend
+ *  is DatagramReceiveBackend::IoUring (Linux only).
+ *
+ *  A single multishot recvmsg request stays armed on the socket: the kernel picks a buffer in
+ *  a ring of preregistered buffers for each incoming datagram and posts a completion, so
+ *  datagrams are received without one syscall each. Buffers go back to the kernel once the
+ *  datagram has been consumed.
+ */
+
+#if defined(__linux__) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #include <linux/io_uring.h>
+        #ifdef IORING_RECV_MULTISHOT
+            #define DATAGRAM_SOCKET_HAS_IO_URING
+        #endif
+    #endif
+#endif
+
+#ifdef DATAGRAM_SOCKET_HAS_IO_URING
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+class UringReceiver
+{
+public:
+    // A received datagram, pointing into a registered buffer until release() is called
+    struct Datagram
+    {
+        const void *    payload = nullptr;
+        unsigned int    payloadLen = 0;
+        bool            truncated = false;
+        sockaddr_in     from;
+        msghdr          control;            // msg_control / msg_controllen only, for CMSG_ macros
+        unsigned short  bufferId = 0;
+    };
+
+    // bufferCount is rounded up to a power of two, payloadCapacity is the biggest datagram expected
+    UringReceiver(int socket,unsigned int bufferCount,unsigned int payloadCapacity,unsigned int controlCapacity);
+    ~UringReceiver();
+
+    bool isInitialized() const { return m_ringFd >= 0; }
+
+    // Get the next received datagram without blocking, returns false when there is none
+    bool next(Datagram & datagram);
+    // Give the datagram buffer back to the kernel
+    void release(const Datagram & datagram);
+
+    // Block until a datagram is available or timeout is elapsed (negative timeout waits forever)
+    bool waitReadable(int timeoutMicroseconds);
+
+private:
+    bool setupRing();
+    bool setupBufferRing();
+    bool armReceive();
+    void closeRing();
+
+    int m_socket = -1;
+    int m_ringFd = -1;
+
+    // Submission and completion rings, shared with the kernel
+    void *          m_sqRing = nullptr;
+    size_t          m_sqRingSize = 0;
+    void *          m_cqRing = nullptr;
+    size_t          m_cqRingSize = 0;
+    io_uring_sqe *  m_sqes = nullptr;
+    size_t          m_sqesSize = 0;
+    unsigned *      m_sqHead = nullptr;
+    unsigned *      m_sqTail = nullptr;
+    unsigned        m_sqMask = 0;
+    unsigned *      m_sqArray = nullptr;
+    unsigned *      m_cqHead = nullptr;
+    unsigned *      m_cqTail = nullptr;
+    unsigned        m_cqMask = 0;
+    io_uring_cqe *  m_cqes = nullptr;
+
+    // Provided buffer ring and the buffers it hands out
+    io_uring_buf_ring * m_bufRing = nullptr;
+    size_t          m_bufRingSize = 0;
+    unsigned char * m_buffers = nullptr;
+    size_t          m_buffersSize = 0;
+    unsigned int    m_bufferCount = 0;
+    unsigned int    m_bufferSize = 0;
+    unsigned short  m_bufRingTail = 0;
+
+    // recvmsg template: tells the kernel how much room to keep for source address and ancillary data
+    msghdr          m_msgTemplate;
+    bool            m_armed = false;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#pragma once
+
+/*
+ *  PONK frame checksum (GeomUdpHeader::dataCrc): the sum of all data bytes of a frame, modulo 2^32.
+ *
+ *  A sum doesn't depend on the order bytes are added in, so it can be updated piece by piece while
+ *  the data is still in cache: senders add each path once serialized, receivers add each chunk when
+ *  it arrives, and the frame never needs a checksum pass of its own.
+ *
+ *  Bytes are summed 16 or 32 at a time with psadbw (sum of absolute differences against zero, which
+ *  adds 8 bytes into a 64 bits lane). AVX2 is picked at run time when the CPU supports it (GCC, Clang,
+ *  or MSVC building for AVX2), SSE2 is always there on x86-64, other CPUs use the scalar loop.
+ */
+
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define PONK_CHECKSUM_SSE2
+    #if defined(__AVX2__)
+        #include <immintrin.h>
+        #define PONK_CHECKSUM_AVX2
+    #elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+        #include <immintrin.h>
+        #define PONK_CHECKSUM_AVX2
+        #define PONK_CHECKSUM_AVX2_RUNTIME
+    #endif
+#endif
+
+// Add size bytes of data to checksum
+inline unsigned int ponkChecksumScalar(const void * data,size_t size,unsigned int checksum = 0)
+{
+    const unsigned char * bytes = static_cast<const unsigned char *>(data);
+    for (size_t i=0; i<size; i++) {
+        checksum += bytes[i];
+    }
+    return checksum;
+}
+
+#ifdef PONK_CHECKSUM_SSE2
+inline unsigned int ponkChecksumSse2(const void * data,size_t size,unsigned int checksum = 0)
+{
+    const unsigned char * bytes = static_cast<const unsigned char *>(data);
+    const __m128i zero = _mm_setzero_si128();
+    // Two accumulators so consecutive psadbw don't wait for each other
+    __m128i sum0 = zero;
+    __m128i sum1 = zero;
+    size_t i = 0;
+    for (; i+32<=size; i+=32) {
+        sum0 = _mm_add_epi64(sum0,_mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i)),zero));
+        sum1 = _mm_add_epi64(sum1,_mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i + 16)),zero));
+    }
+    if (i+16 <= size) {
+        sum0 = _mm_add_epi64(sum0,_mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i)),zero));
+        i += 16;
+    }
+    sum0 = _mm_add_epi64(sum0,sum1);
+    sum0 = _mm_add_epi64(sum0,_mm_unpackhi_epi64(sum0,sum0));
+    checksum += static_cast<unsigned int>(_mm_cvtsi128_si32(sum0));
+    return ponkChecksumScalar(bytes + i,size - i,checksum);
+}
+#endif
+
+#ifdef PONK_CHECKSUM_AVX2
+#ifdef PONK_CHECKSUM_AVX2_RUNTIME
+__attribute__((target("avx2")))
+#endif
+inline unsigned int ponkChecksumAvx2(const void * data,size_t size,unsigned int checksum = 0)
+{
+    const unsigned char * bytes = static_cast<const unsigned char *>(data);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i sum0 = zero;
+    __m256i sum1 = zero;
+    size_t i = 0;
+    for (; i+64<=size; i+=64) {
+        sum0 = _mm256_add_epi64(sum0,_mm256_sad_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + i)),zero));
+        sum1 = _mm256_add_epi64(sum1,_mm256_sad_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + i + 32)),zero));
+    }
+    sum0 = _mm256_add_epi64(sum0,sum1);
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(sum0),_mm256_extracti128_si256(sum0,1));
+    sum = _mm_add_epi64(sum,_mm_unpackhi_epi64(sum,sum));
+    checksum += static_cast<unsigned int>(_mm_cvtsi128_si32(sum));
+    return ponkChecksumSse2(bytes + i,size - i,checksum);
+}
+#endif
+
+// Add size bytes of data to checksum, with the fastest kernel available on this CPU
+inline unsigned int ponkChecksum(const void * data,size_t size,unsigned int checksum = 0)
+{
+#if defined(PONK_CHECKSUM_AVX2_RUNTIME)
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2") != 0;
+    return hasAvx2 ? ponkChecksumAvx2(data,size,checksum) : ponkChecksumSse2(data,size,checksum);
+#elif defined(PONK_CHECKSUM_AVX2)
+    return ponkChecksumAvx2(data,size,checksum);
+#elif defined(PONK_CHECKSUM_SSE2)
+    return ponkChecksumSse2(data,size,checksum);
+#else
+    return ponkChecksumScalar(data,size,checksum);
+#endif
+}
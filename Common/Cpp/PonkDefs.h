@@ -96,7 +96,7 @@
  *
  *      - MadMapper / MadLaser: most of those parameters can be adjusted at surface level. Adding meta data will override
  *        settings set at surface level for the path it is attached to. Those parameters are documented in MadLaser
- *        documentation
+ *        documentation. PonkMetaData/PonkMetaData.h decodes them to their type and range
  *          - PATHNUMB: Integer number for identifying the shape (ie if the first shape for previous frame disappeared,
  *            MadMapper can anyway know this shape corresponds to a shape in previous frame using this identifier, it
  *            might be used for instance in dispatching algorithms)
@@ -134,6 +134,9 @@
 #define PONK_MAX_DATA_BYTES_PER_PACKET 8192
 // Geom UDP port = 5583
 #define PONK_PORT 5583
+// Suggested multicast group when a sender feeds several receivers = 239.255.55.83
+// (administratively scoped range, stays inside the organization network)
+#define PONK_DEFAULT_MULTICAST_GROUP ((239u<<24) + (255u<<16) + (55u<<8) + 83u)
 
 #ifdef _MSC_VER
     // ms VC .NET
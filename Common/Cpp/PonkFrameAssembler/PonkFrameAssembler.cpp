@@ -0,0 +1,367 @@
+#include "PonkFrameAssembler.h"
+#include "PonkChecksum/PonkChecksum.h"
+#include "PonkReceiverStats/PonkReceiverStats.h"
+#include "PonkDefs.h"
+#include <algorithm>
+#include <cstring>
+
+// A sender sending only chunks older than its window restarted its frame numbering
+#define PONK_ASSEMBLER_RESYNC_LATE_CHUNKS 256
+// A sender that didn't start a frame for this long can be replaced by a new one once maxSenders is reached
+#define PONK_ASSEMBLER_SENDER_IDLE_MS 2000
+
+PonkFrameAssembler::PonkFrameAssembler(FrameCallback callback,unsigned int maxFramesInFlight,PonkReceiverStats * receiverStats,
+                                       unsigned int maxSenders)
+    : m_callback(callback)
+    , m_maxFramesInFlight(std::max(1u,std::min(128u,maxFramesInFlight)))
+    , m_maxSenders(std::max(1u,maxSenders))
+    , m_receiverStats(receiverStats)
+{
+}
+
+PonkFrameAssembler::~PonkFrameAssembler()
+{
+}
+
+PonkFrameAssembler::SenderState * PonkFrameAssembler::sender(const PonkSenderKey & key)
+{
+    if (m_lastSender && m_lastSender->key == key) {
+        return m_lastSender;
+    }
+    auto it = m_senders.find(key);
+    if (it == m_senders.end()) {
+        const auto now = std::chrono::steady_clock::now();
+        if (m_senders.size() >= m_maxSenders && !evictIdleSender(now)) {
+            return nullptr;
+        }
+        it = m_senders.insert(std::make_pair(key,std::unique_ptr<SenderState>(new SenderState()))).first;
+        it->second->key = key;
+        it->second->lastFrameStart = now;
+    }
+    m_lastSender = it->second.get();
+    return m_lastSender;
+}
+
+// Remove the sender that started a frame least recently, if it is idle
+bool PonkFrameAssembler::evictIdleSender(std::chrono::steady_clock::time_point now)
+{
+    auto oldest = m_senders.begin();
+    for (auto it = m_senders.begin(); it != m_senders.end(); ++it) {
+        if (it->second->lastFrameStart < oldest->second->lastFrameStart) {
+            oldest = it;
+        }
+    }
+    if (oldest == m_senders.end() || now - oldest->second->lastFrameStart < std::chrono::milliseconds(PONK_ASSEMBLER_SENDER_IDLE_MS)) {
+        return false;
+    }
+    SenderState & state = *oldest->second;
+    for (auto & slot: state.slots) {
+        giveUp(state,slot);
+    }
+    if (m_lastSender == &state) {
+        m_lastSender = nullptr;
+    }
+    m_senders.erase(oldest);
+    m_stats.sendersEvicted++;
+    return true;
+}
+
+// expected: the frame number of the slot was sent, an empty slot is a frame of which no chunk arrived
+void PonkFrameAssembler::giveUp(SenderState & state,FrameSlot & slot,bool expected)
+{
+    if (slot.state == SlotState::Assembling) {
+        m_stats.framesIncomplete++;
+        if (state.stats) {
+            state.stats->countFrameLost(slot.chunkCount - slot.receivedCount);
+        }
+        releaseBuffer(slot);
+    } else if (slot.state == SlotState::Empty && expected) {
+        // How many chunks it had is unknown
+        m_stats.framesMissing++;
+        if (state.stats) {
+            state.stats->countFrameLost(0);
+        }
+    }
+    slot.state = SlotState::Empty;
+}
+
+void PonkFrameAssembler::releaseBuffer(FrameSlot & slot)
+{
+    if (slot.buffer) {
+        m_bufferPool.push_back(std::move(slot.buffer));
+    }
+}
+
+// Grow without shrinking: a reused buffer is already big enough and isn't written to
+static unsigned char * reserveBytes(std::vector<unsigned char> & buffer,size_t size)
+{
+    if (buffer.size() < size || buffer.empty()) {
+        buffer.resize(std::max<size_t>(size,1));
+    }
+    return &buffer[0];
+}
+
+void PonkFrameAssembler::placeChunk(FrameSlot & slot,unsigned int chunkNumber,const unsigned char * payload,unsigned int size)
+{
+    std::vector<unsigned char> & buffer = *slot.buffer;
+    const bool lastChunk = chunkNumber + 1 == slot.chunkCount;
+
+    if (!slot.irregular) {
+        if (slot.chunkCount == 1) {
+            memcpy(reserveBytes(buffer,size),payload,size);
+            slot.lastChunkSize = size;
+            return;
+        }
+        if (lastChunk && slot.stride == 0) {
+            // Position depends on the size of the other chunks, wait for one of them
+            memcpy(reserveBytes(buffer,size),payload,size);
+            slot.lastChunkSize = size;
+            slot.lastChunkPending = true;
+            return;
+        }
+        if (!lastChunk && slot.stride == 0) {
+            if (slot.lastChunkPending && slot.lastChunkSize > size) {
+                makeIrregular(slot);
+            } else {
+                slot.stride = size;
+                reserveBytes(buffer,static_cast<size_t>(slot.chunkCount) * slot.stride);
+                if (slot.lastChunkPending) {
+                    memmove(&buffer[(slot.chunkCount - 1) * slot.stride],&buffer[0],slot.lastChunkSize);
+                    slot.lastChunkPending = false;
+                }
+            }
+        }
+        if (!slot.irregular) {
+            if ((lastChunk && size > slot.stride) || (!lastChunk && size != slot.stride)) {
+                makeIrregular(slot);
+            } else {
+                memcpy(&buffer[chunkNumber * slot.stride],payload,size);
+                if (lastChunk) {
+                    slot.lastChunkSize = size;
+                }
+                return;
+            }
+        }
+    }
+
+    memcpy(reserveBytes(buffer,slot.appendOffset + size) + slot.appendOffset,payload,size);
+    slot.chunkOffsets[chunkNumber] = static_cast<unsigned int>(slot.appendOffset);
+    slot.chunkSizes[chunkNumber] = size;
+    slot.appendOffset += size;
+}
+
+void PonkFrameAssembler::makeIrregular(FrameSlot & slot)
+{
+    // Chunks already placed stay where they are, the next ones are appended after them
+    slot.irregular = true;
+    slot.chunkOffsets.resize(256);
+    slot.chunkSizes.resize(256);
+    const unsigned int lastChunkNumber = slot.chunkCount - 1u;
+    if (slot.stride == 0) {
+        // Only the last chunk was received
+        slot.chunkOffsets[lastChunkNumber] = 0;
+        slot.chunkSizes[lastChunkNumber] = slot.lastChunkSize;
+        slot.appendOffset = slot.lastChunkSize;
+        slot.lastChunkPending = false;
+        return;
+    }
+    for (unsigned int i=0; i<slot.chunkCount; i++) {
+        slot.chunkOffsets[i] = i * slot.stride;
+        slot.chunkSizes[i] = i == lastChunkNumber ? slot.lastChunkSize : slot.stride;
+    }
+    slot.appendOffset = static_cast<size_t>(slot.chunkCount) * slot.stride;
+}
+
+PonkChunkResult PonkFrameAssembler::addChunk(const GenericAddr & source,const void * datagram,unsigned int size,unsigned long long timestampNs)
+{
+    if (size < sizeof(GeomUdpHeader)) {
+        m_stats.invalidChunks++;
+        return PonkChunkResult::Invalid;
+    }
+    const GeomUdpHeader * header = static_cast<const GeomUdpHeader *>(datagram);
+    if (memcmp(header->headerString,PONK_HEADER_STRING,sizeof(header->headerString)) != 0 ||
+        header->chunkCount == 0 || header->chunkNumber >= header->chunkCount) {
+        m_stats.invalidChunks++;
+        if (m_receiverStats) {
+            m_receiverStats->countInvalidDatagram();
+        }
+        return PonkChunkResult::Invalid;
+    }
+
+    PonkSenderKey key;
+    key.ip = source.ip;
+    key.port = source.port;
+    key.senderIdentifier = header->senderIdentifier;
+    SenderState * senderState = sender(key);
+    if (!senderState) {
+        m_stats.senderRejections++;
+        if (m_receiverStats) {
+            m_receiverStats->countSenderRejection();
+        }
+        return PonkChunkResult::TooManySenders;
+    }
+    SenderState & state = *senderState;
+    if (!state.statsResolved && m_receiverStats) {
+        state.stats = m_receiverStats->sender(key,header->senderName);
+        state.statsResolved = true;
+    }
+    if (state.stats) {
+        state.stats->countChunk(size);
+        if (timestampNs != 0 && state.lastChunkTimestampNs != 0 && timestampNs >= state.lastChunkTimestampNs) {
+            state.stats->recordChunkInterArrival(timestampNs - state.lastChunkTimestampNs);
+        }
+        state.lastChunkTimestampNs = timestampNs;
+    }
+    if (header->protocolVersion > PONK_PROTOCOL_VERSION) {
+        m_stats.invalidChunks++;
+        if (state.stats) {
+            state.stats->countUnsupportedVersion();
+        }
+        return PonkChunkResult::UnsupportedVersion;
+    }
+
+    // Move the window forward: frames too far behind the newest one are given up
+    const unsigned char frameNumber = header->frameNumber;
+    if (!state.hasLatestFrame) {
+        state.hasLatestFrame = true;
+        state.latestFrameNumber = frameNumber;
+        state.windowFrames = 1;
+    } else {
+        const int distance = static_cast<signed char>(frameNumber - state.latestFrameNumber);
+        if (distance > 0) {
+            for (int step=1; step<=distance; step++) {
+                // Frames given up before the window holds maxFramesInFlight frames come before the first one
+                if (state.windowFrames <= m_maxFramesInFlight) {
+                    state.windowFrames++;
+                }
+                giveUp(state,state.slots[static_cast<unsigned char>(state.latestFrameNumber + step - m_maxFramesInFlight)],
+                       state.windowFrames > m_maxFramesInFlight);
+            }
+            state.latestFrameNumber = frameNumber;
+        } else if (-distance >= static_cast<int>(m_maxFramesInFlight)) {
+            if (++state.consecutiveLateChunks < PONK_ASSEMBLER_RESYNC_LATE_CHUNKS) {
+                m_stats.lateChunks++;
+                if (state.stats) {
+                    state.stats->countLateChunk();
+                }
+                return PonkChunkResult::Late;
+            }
+            // Sender restarted with a new frame numbering, start over
+            for (auto & slot: state.slots) {
+                giveUp(state,slot);
+            }
+            state.latestFrameNumber = frameNumber;
+            state.windowFrames = 1;
+        }
+    }
+    state.consecutiveLateChunks = 0;
+
+    FrameSlot & slot = state.slots[frameNumber];
+    if (slot.state != SlotState::Empty && (slot.chunkCount != header->chunkCount || slot.dataCrc != header->dataCrc)) {
+        // Same frame number but another frame: the previous one won't get its missing chunks
+        giveUp(state,slot);
+    }
+    if (slot.state == SlotState::Completed) {
+        m_stats.duplicateChunks++;
+        if (state.stats) {
+            state.stats->countDuplicateChunk();
+        }
+        return PonkChunkResult::Duplicate;
+    }
+    if (slot.state == SlotState::Empty) {
+        slot.state = SlotState::Assembling;
+        slot.chunkCount = header->chunkCount;
+        slot.dataCrc = header->dataCrc;
+        slot.checksum = 0;
+        slot.receivedCount = 0;
+        memset(slot.received,0,sizeof(slot.received));
+        slot.firstChunkTimestampNs = timestampNs;
+        state.lastFrameStart = std::chrono::steady_clock::now();
+        slot.stride = 0;
+        slot.lastChunkSize = 0;
+        slot.lastChunkPending = false;
+        slot.irregular = false;
+        slot.appendOffset = 0;
+        if (m_bufferPool.empty()) {
+            slot.buffer.reset(new std::vector<unsigned char>());
+        } else {
+            slot.buffer = std::move(m_bufferPool.back());
+            m_bufferPool.pop_back();
+        }
+        memcpy(state.name,header->senderName,sizeof(header->senderName));
+    }
+
+    const unsigned int chunkNumber = header->chunkNumber;
+    const unsigned long long chunkBit = 1ull << (chunkNumber % 64);
+    if (slot.received[chunkNumber / 64] & chunkBit) {
+        m_stats.duplicateChunks++;
+        if (state.stats) {
+            state.stats->countDuplicateChunk();
+        }
+        return PonkChunkResult::Duplicate;
+    }
+
+    const unsigned char * payload = static_cast<const unsigned char *>(datagram) + sizeof(GeomUdpHeader);
+    const unsigned int payloadSize = size - static_cast<unsigned int>(sizeof(GeomUdpHeader));
+    placeChunk(slot,chunkNumber,payload,payloadSize);
+    slot.checksum = ponkChecksum(payload,payloadSize,slot.checksum);
+    slot.received[chunkNumber / 64] |= chunkBit;
+    slot.receivedCount++;
+    slot.lastChunkTimestampNs = timestampNs;
+
+    if (slot.receivedCount < slot.chunkCount) {
+        return PonkChunkResult::Accepted;
+    }
+    return completeFrame(state,frameNumber,slot) ? PonkChunkResult::Completed : PonkChunkResult::CrcMismatch;
+}
+
+bool PonkFrameAssembler::completeFrame(SenderState & state,unsigned char frameNumber,FrameSlot & slot)
+{
+    slot.state = SlotState::Completed;
+    if (slot.checksum != slot.dataCrc) {
+        m_stats.crcMismatches++;
+        if (state.stats) {
+            state.stats->countCrcFailure();
+        }
+        releaseBuffer(slot);
+        return false;
+    }
+
+    const unsigned char * data = &(*slot.buffer)[0];
+    size_t size = static_cast<size_t>(slot.chunkCount - 1) * slot.stride + slot.lastChunkSize;
+    if (slot.irregular) {
+        size = 0;
+        for (unsigned int i=0; i<slot.chunkCount; i++) {
+            size += slot.chunkSizes[i];
+        }
+        const unsigned char * stored = data;
+        unsigned char * linear = reserveBytes(m_linearBuffer,size);
+        data = linear;
+        for (unsigned int i=0; i<slot.chunkCount; i++) {
+            memcpy(linear,stored + slot.chunkOffsets[i],slot.chunkSizes[i]);
+            linear += slot.chunkSizes[i];
+        }
+    }
+    m_stats.framesCompleted++;
+    if (state.stats) {
+        state.stats->countFrameCompleted();
+        if (slot.firstChunkTimestampNs != 0 && slot.lastChunkTimestampNs >= slot.firstChunkTimestampNs) {
+            state.stats->recordReassembly(slot.lastChunkTimestampNs - slot.firstChunkTimestampNs);
+        }
+    }
+
+    Frame frame;
+    frame.sender = state.key;
+    frame.senderName = state.name;
+    frame.frameNumber = frameNumber;
+    frame.dataCrc = slot.dataCrc;
+    frame.data = data;
+    frame.size = size;
+    frame.firstChunkTimestampNs = slot.firstChunkTimestampNs;
+    frame.lastChunkTimestampNs = slot.lastChunkTimestampNs;
+    if (m_callback) {
+        m_callback(frame);
+    }
+    releaseBuffer(slot);
+    return true;
+}
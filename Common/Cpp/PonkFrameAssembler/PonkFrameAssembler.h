@@ -0,0 +1,185 @@
+#pragma once
+
+/*
+ *  Reassembly of PONK frames from their chunks, for receivers handling several senders at once.
+ *
+ *  Chunks are grouped by sender, a sender being identified by its source address and its
+ *  senderIdentifier: two senders never mix their chunks, even when they use the same identifier.
+ *  Each sender has a window of frames in flight indexed by the 8 bits frame number, so a frame
+ *  keeps being assembled when chunks of the next frames arrive before its last chunk (reordering,
+ *  or a frame waiting for a retransmitted datagram on a busy network).
+ *
+ *  A frame in flight is given up (counted as incomplete) once the sender is maxFramesInFlight
+ *  frames ahead of it.
+ *
+ *  At most maxSenders senders are tracked. A new sender beyond that replaces the one that started a
+ *  frame least recently, if it has been idle for PONK_ASSEMBLER_SENDER_IDLE_MS (restarted senders
+ *  come back from a new port). Otherwise its chunks are refused: a flood of spoofed source addresses
+ *  can't grow memory or push out active senders.
+ *
+ *  Payloads are copied once, from the receive buffer to their final position in a contiguous frame
+ *  buffer taken from a pool: senders cut frames in chunks of the same size but the last one, so
+ *  chunk N lands at N times the size of the first non last chunk received. A frame whose last chunk
+ *  comes first keeps it aside in its buffer until that size is known. Frames cut in chunks of
+ *  varying sizes are stored in arrival order and put in chunk order once complete.
+ *
+ *  The frame checksum is updated with each chunk when it arrives (see PonkChecksum.h): frames whose
+ *  data doesn't match the CRC announced by the sender are dropped without a second pass over them.
+ *
+ *  Given PonkReceiverStats, what happens to chunks and frames is also counted per sender, with chunk
+ *  inter-arrival and reassembly times when addChunk gets arrival timestamps.
+ */
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "DatagramSocket/DatagramSocket.h"
+
+class PonkReceiverStats;
+class PonkSenderStats;
+
+// Identifies a sender: source address and the senderIdentifier of its chunk headers
+struct PonkSenderKey
+{
+    unsigned int    ip = 0;
+    unsigned short  port = 0;
+    unsigned int    senderIdentifier = 0;
+
+    bool operator==(const PonkSenderKey & other) const {
+        return ip == other.ip && port == other.port && senderIdentifier == other.senderIdentifier;
+    }
+};
+
+struct PonkSenderKeyHash
+{
+    size_t operator()(const PonkSenderKey & key) const {
+        return std::hash<unsigned long long>()((static_cast<unsigned long long>(key.ip) << 16 | key.port) ^
+                                               (static_cast<unsigned long long>(key.senderIdentifier) << 32));
+    }
+};
+
+// What happened to a chunk given to PonkFrameAssembler::addChunk
+enum class PonkChunkResult
+{
+    Accepted,           // Stored, its frame still misses chunks
+    Completed,          // Last missing chunk of its frame, the frame callback has been called
+    CrcMismatch,        // Last missing chunk of its frame, but frame data doesn't match its CRC: frame dropped
+    Duplicate,          // Chunk already received for this frame, ignored
+    Late,               // Frame already given up, ignored
+    UnsupportedVersion, // Protocol version newer than this receiver, ignored
+    TooManySenders,     // New sender while maxSenders senders are active, ignored
+    Invalid             // Not a PONK chunk or inconsistent header
+};
+
+class PonkFrameAssembler
+{
+public:
+    // A complete frame, only valid during the frame callback
+    struct Frame
+    {
+        PonkSenderKey           sender;
+        const char *            senderName = nullptr;   // Null terminated
+        unsigned char           frameNumber = 0;
+        unsigned int            dataCrc = 0;            // Checked against data
+        const unsigned char *   data = nullptr;         // Payloads of all chunks, in chunk order (pooled buffer)
+        size_t                  size = 0;
+        unsigned long long      firstChunkTimestampNs = 0;  // Timestamps given to addChunk for the first and
+        unsigned long long      lastChunkTimestampNs = 0;   // last received chunks of this frame
+    };
+    typedef std::function<void(const Frame &)> FrameCallback;
+
+    // Counters for all senders since the assembler was created
+    struct Stats
+    {
+        unsigned long long  framesCompleted = 0;
+        unsigned long long  framesIncomplete = 0;   // Given up with missing chunks
+        unsigned long long  framesMissing = 0;      // Given up without any chunk received
+        unsigned long long  duplicateChunks = 0;
+        unsigned long long  lateChunks = 0;
+        unsigned long long  invalidChunks = 0;      // Unsupported protocol versions included
+        unsigned long long  crcMismatches = 0;      // Complete frames dropped because of their data CRC
+        unsigned long long  sendersEvicted = 0;     // Idle senders replaced by new ones
+        unsigned long long  senderRejections = 0;   // Chunks of new senders refused, one per chunk
+    };
+
+    // maxFramesInFlight is clamped between 1 and 128 (half the frame number range). receiverStats, when
+    // given, gets the counters of each sender and must outlive the assembler
+    explicit PonkFrameAssembler(FrameCallback callback,unsigned int maxFramesInFlight = 16,PonkReceiverStats * receiverStats = nullptr,
+                                unsigned int maxSenders = 64);
+    ~PonkFrameAssembler();
+
+    // Add a received datagram (PONK header and payload). The frame callback is called from
+    // this function when the chunk completes its frame
+    PonkChunkResult addChunk(const GenericAddr & source,const void * datagram,unsigned int size,unsigned long long timestampNs = 0);
+
+    const Stats & stats() const { return m_stats; }
+    size_t senderCount() const { return m_senders.size(); }
+
+private:
+    enum class SlotState
+    {
+        Empty,
+        Assembling,
+        Completed   // Kept until it leaves the window, so late duplicates don't start a new frame
+    };
+
+    struct FrameSlot
+    {
+        SlotState           state = SlotState::Empty;
+        unsigned char       chunkCount = 0;
+        unsigned int        dataCrc = 0;
+        unsigned int        checksum = 0;           // Of chunks received so far
+        unsigned int        receivedCount = 0;
+        unsigned long long  received[4] = {0,0,0,0};   // One bit per chunk number
+        unsigned long long  firstChunkTimestampNs = 0;
+        unsigned long long  lastChunkTimestampNs = 0;
+
+        // Frame buffer from the pool while assembling, its size only grows: bytes past the frame are garbage
+        std::unique_ptr<std::vector<unsigned char>> buffer;
+        unsigned int        stride = 0;             // Payload size of all chunks but the last one, 0 until known
+        unsigned int        lastChunkSize = 0;
+        bool                lastChunkPending = false;   // Last chunk received before stride was known, kept at offset 0
+        // Chunks of varying sizes: payloads appended in arrival order, located by chunk number
+        bool                irregular = false;
+        size_t              appendOffset = 0;
+        std::vector<unsigned int> chunkOffsets;
+        std::vector<unsigned int> chunkSizes;
+    };
+
+    struct SenderState
+    {
+        PonkSenderKey       key;
+        char                name[33] = {};
+        bool                hasLatestFrame = false;
+        unsigned char       latestFrameNumber = 0;
+        unsigned int        consecutiveLateChunks = 0;
+        unsigned int        windowFrames = 0;       // Frame numbers since the first frame, up to maxFramesInFlight + 1
+        PonkSenderStats *   stats = nullptr;        // Null without receiver stats or past their maxSenders
+        bool                statsResolved = false;
+        unsigned long long  lastChunkTimestampNs = 0;
+        std::chrono::steady_clock::time_point lastFrameStart;   // For eviction, only read when maxSenders is reached
+        FrameSlot           slots[256];
+    };
+
+    SenderState * sender(const PonkSenderKey & key);
+    bool evictIdleSender(std::chrono::steady_clock::time_point now);
+    void giveUp(SenderState & sender,FrameSlot & slot,bool expected = false);
+    void releaseBuffer(FrameSlot & slot);
+    void placeChunk(FrameSlot & slot,unsigned int chunkNumber,const unsigned char * payload,unsigned int size);
+    void makeIrregular(FrameSlot & slot);
+    bool completeFrame(SenderState & sender,unsigned char frameNumber,FrameSlot & slot);
+
+    FrameCallback m_callback;
+    unsigned int m_maxFramesInFlight;
+    unsigned int m_maxSenders;
+    Stats m_stats;
+    PonkReceiverStats * m_receiverStats;
+    std::unordered_map<PonkSenderKey,std::unique_ptr<SenderState>,PonkSenderKeyHash> m_senders;
+    SenderState * m_lastSender = nullptr;   // Chunks of a frame come in a row, skip the lookup
+
+    // Frame buffers of frames not being assembled, reused so steady state reception doesn't allocate
+    std::vector<std::unique_ptr<std::vector<unsigned char>>> m_bufferPool;
+    std::vector<unsigned char> m_linearBuffer;  // Chunks of irregular frames put back in order
+};
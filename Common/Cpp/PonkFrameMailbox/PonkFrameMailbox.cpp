@@ -0,0 +1,109 @@
+#include "PonkFrameMailbox.h"
+#include <algorithm>
+#include <cstring>
+
+void PonkFrameMailbox::publish(const PonkFrameAssembler::Frame & frame)
+{
+    PonkMailboxFrame & back = m_frames.back();
+    back.sender = frame.sender;
+    strncpy(back.senderName,frame.senderName,sizeof(back.senderName) - 1);
+    back.frameNumber = frame.frameNumber;
+    back.firstChunkTimestampNs = frame.firstChunkTimestampNs;
+    back.lastChunkTimestampNs = frame.lastChunkTimestampNs;
+    back.data.assign(frame.data,frame.data + frame.size);
+
+    m_published.fetch_add(1,std::memory_order_relaxed);
+    if (m_frames.publish()) {
+        m_superseded.fetch_add(1,std::memory_order_relaxed);
+    }
+}
+
+const PonkMailboxFrame * PonkFrameMailbox::acquire()
+{
+    if (!m_frames.acquire()) {
+        return nullptr;
+    }
+    m_acquired.fetch_add(1,std::memory_order_relaxed);
+    m_acquiredSender = m_frames.front().sender;
+    return &m_frames.front();
+}
+
+void PonkFrameMailbox::reassign(const PonkSenderKey & sender)
+{
+    m_sender = sender;
+    m_published.store(0,std::memory_order_relaxed);
+    m_superseded.store(0,std::memory_order_relaxed);
+    m_acquired.store(0,std::memory_order_relaxed);
+    // Counters of a generation are seen reset once the generation is seen
+    m_generation.fetch_add(1,std::memory_order_release);
+}
+
+PonkFrameMailbox::Stats PonkFrameMailbox::stats() const
+{
+    Stats stats;
+    stats.generation = m_generation.load(std::memory_order_acquire);
+    stats.published = m_published.load(std::memory_order_relaxed);
+    stats.superseded = m_superseded.load(std::memory_order_relaxed);
+    stats.acquired = m_acquired.load(std::memory_order_relaxed);
+    return stats;
+}
+
+PonkFrameMailboxes::PonkFrameMailboxes(unsigned int maxSenders,unsigned int senderIdleMs)
+    : m_mailboxes(new PonkFrameMailbox[(std::max)(maxSenders,1u)])
+    , m_maxSenders((std::max)(maxSenders,1u))
+    , m_senderIdle(senderIdleMs)
+{
+}
+
+PonkFrameMailboxes::~PonkFrameMailboxes()
+{
+}
+
+bool PonkFrameMailboxes::publish(const PonkFrameAssembler::Frame & frame)
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (!m_lastMailbox || !(m_lastMailbox->m_sender == frame.sender)) {
+        auto it = m_indices.find(frame.sender);
+        if (it != m_indices.end()) {
+            m_lastMailbox = &m_mailboxes[it->second];
+        } else {
+            const unsigned int index = m_senderCount.load(std::memory_order_relaxed);
+            if (index < m_maxSenders) {
+                m_mailboxes[index].m_sender = frame.sender;
+                m_indices.insert(std::make_pair(frame.sender,index));
+                // The consumer sees the mailbox once its sender is set
+                m_senderCount.store(index + 1,std::memory_order_release);
+                m_lastMailbox = &m_mailboxes[index];
+            } else {
+                PonkFrameMailbox * mailbox = reassignIdleMailbox(frame.sender,now);
+                if (!mailbox) {
+                    return false;
+                }
+                m_lastMailbox = mailbox;
+            }
+        }
+    }
+    m_lastMailbox->m_lastPublish = now;
+    m_lastMailbox->publish(frame);
+    return true;
+}
+
+// Give the mailbox published to least recently to a new sender, if it is idle
+PonkFrameMailbox * PonkFrameMailboxes::reassignIdleMailbox(const PonkSenderKey & sender,std::chrono::steady_clock::time_point now)
+{
+    unsigned int oldest = 0;
+    for (unsigned int i=1; i<m_maxSenders; i++) {
+        if (m_mailboxes[i].m_lastPublish < m_mailboxes[oldest].m_lastPublish) {
+            oldest = i;
+        }
+    }
+    PonkFrameMailbox & mailbox = m_mailboxes[oldest];
+    if (now - mailbox.m_lastPublish < m_senderIdle) {
+        return nullptr;
+    }
+    m_indices.erase(mailbox.m_sender);
+    m_indices.insert(std::make_pair(sender,oldest));
+    mailbox.reassign(sender);
+    m_reassigned.fetch_add(1,std::memory_order_relaxed);
+    return &mailbox;
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+/*
+ *  Hand off of complete frames from the network thread to a consumer thread (laser output, rendering).
+ *
+ *  Each sender has a mailbox holding its newest frame in a triple buffer, so publishing and acquiring
+ *  never wait for each other: the network thread fills the back buffer and swaps it with the middle
+ *  one, the consumer swaps its front buffer with the middle one when a newer frame is there.
+ *
+ *  A frame published before the previous one was acquired replaces it and is counted as superseded:
+ *  a slow consumer skips frames instead of queueing them, it is never more than one frame behind and
+ *  never holds back packet intake.
+ *
+ *  Frame buffers keep their capacity, once they fit the largest frame of their sender publishing
+ *  doesn't allocate. Only the first frame of a sender allocates its mailbox slot.
+ *
+ *  Once maxSenders mailboxes are in use, a new sender gets the mailbox that was published to least
+ *  recently, if it has been idle for senderIdleMs (restarted senders come back from a new port, the
+ *  same as in PonkFrameAssembler). Its generation then changes and its counters start over.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "PonkFrameAssembler/PonkFrameAssembler.h"
+
+// Single producer, single consumer triple buffer, wait-free on both sides
+template <typename T>
+class PonkTripleBuffer
+{
+public:
+    // Producer: buffer to fill before publishing it
+    T & back() { return m_buffers[m_back]; }
+
+    // Producer: make the back buffer the newest one. Returns true when the one it replaces was never acquired
+    bool publish() {
+        const unsigned int previous = m_middle.exchange(m_back | FreshBit, std::memory_order_acq_rel);
+        m_back = previous & IndexMask;
+        return (previous & FreshBit) != 0;
+    }
+
+    // Consumer: take the newest buffer, false when nothing was published since the last call
+    bool acquire() {
+        if ((m_middle.load(std::memory_order_relaxed) & FreshBit) == 0) {
+            return false;
+        }
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & IndexMask;
+        return true;
+    }
+
+    // Consumer: last acquired buffer, valid until the next acquire
+    const T & front() const { return m_buffers[m_front]; }
+
+private:
+    enum { IndexMask = 3, FreshBit = 4 };
+
+    T m_buffers[3];
+    std::atomic<unsigned int> m_middle{1};  // Index of the middle buffer, FreshBit when published and not acquired
+    unsigned int m_back = 0;                // Producer only
+    unsigned int m_front = 2;               // Consumer only
+};
+
+// A frame as seen by the consumer, copied from PonkFrameAssembler::Frame
+struct PonkMailboxFrame
+{
+    PonkSenderKey               sender;
+    char                        senderName[33] = {};
+    unsigned char               frameNumber = 0;
+    unsigned long long          firstChunkTimestampNs = 0;
+    unsigned long long          lastChunkTimestampNs = 0;
+    std::vector<unsigned char>  data;
+};
+
+class PonkFrameMailbox
+{
+public:
+    struct Stats
+    {
+        unsigned int        generation = 0;     // Of the mailbox when the counters were read
+        unsigned long long  published = 0;
+        unsigned long long  superseded = 0;     // Replaced by a newer frame before being acquired
+        unsigned long long  acquired = 0;
+    };
+
+    // Network thread: copy a complete frame to the mailbox
+    void publish(const PonkFrameAssembler::Frame & frame);
+
+    // Consumer thread: newest frame when one was published since the last call, else null.
+    // The frame stays valid until the next call
+    const PonkMailboxFrame * acquire();
+
+    // Consumer thread: sender of the last acquired frame
+    const PonkSenderKey & sender() const { return m_acquiredSender; }
+    // Changes each time the mailbox is handed to another sender
+    unsigned int generation() const { return m_generation.load(std::memory_order_acquire); }
+    Stats stats() const;
+
+private:
+    friend class PonkFrameMailboxes;
+
+    // Network thread: hand the mailbox to another sender
+    void reassign(const PonkSenderKey & sender);
+
+    PonkSenderKey m_sender;             // Network thread
+    std::chrono::steady_clock::time_point m_lastPublish;   // Network thread
+    PonkSenderKey m_acquiredSender;     // Consumer thread
+    std::atomic<unsigned int> m_generation{0};
+    PonkTripleBuffer<PonkMailboxFrame> m_frames;
+    std::atomic<unsigned long long> m_published{0};
+    std::atomic<unsigned long long> m_superseded{0};
+    std::atomic<unsigned long long> m_acquired{0};
+};
+
+// Mailboxes of all senders handled by a network thread
+class PonkFrameMailboxes
+{
+public:
+    explicit PonkFrameMailboxes(unsigned int maxSenders = 64,unsigned int senderIdleMs = 2000);
+    ~PonkFrameMailboxes();
+
+    // Network thread: publish a complete frame to its sender mailbox, false when maxSenders other senders
+    // have one and none of them is idle
+    bool publish(const PonkFrameAssembler::Frame & frame);
+
+    // Consumer thread: mailboxes are only added, index i always is the same mailbox. Its sender changes
+    // with its generation
+    unsigned int senderCount() const { return m_senderCount.load(std::memory_order_acquire); }
+    PonkFrameMailbox & mailbox(unsigned int index) { return m_mailboxes[index]; }
+
+    // Mailboxes handed to a new sender since creation
+    unsigned long long reassignedCount() const { return m_reassigned.load(std::memory_order_relaxed); }
+
+private:
+    PonkFrameMailbox * reassignIdleMailbox(const PonkSenderKey & sender,std::chrono::steady_clock::time_point now);
+
+    std::unique_ptr<PonkFrameMailbox[]> m_mailboxes;
+    unsigned int m_maxSenders;
+    std::chrono::milliseconds m_senderIdle;
+    std::atomic<unsigned long long> m_reassigned{0};
+    std::atomic<unsigned int> m_senderCount{0};
+    // Network thread only
+    std::unordered_map<PonkSenderKey,unsigned int,PonkSenderKeyHash> m_indices;
+    PonkFrameMailbox * m_lastMailbox = nullptr;
+};
@@ -0,0 +1,95 @@
+#include "PonkFrameParser.h"
+#include "PonkPointDecode.h"
+
+PonkFrameParser::PonkFrameParser()
+{
+}
+
+PonkFrameParser::~PonkFrameParser()
+{
+}
+
+unsigned int PonkFrameParser::bytesPerPoint(unsigned char dataFormat)
+{
+    switch (dataFormat) {
+        case PONK_DATA_FORMAT_XYRGB_U16:
+            return 5 * sizeof(unsigned short);
+        case PONK_DATA_FORMAT_XY_F32_RGB_U8:
+            return 2 * sizeof(float) + 3 * sizeof(unsigned char);
+        default:
+            return 0;
+    }
+}
+
+void PonkFrameParser::reservePoints(size_t count)
+{
+    if (m_x.size() >= count) {
+        return;
+    }
+    // Room for a few frames with more points before growing again
+    const size_t size = count + count / 2;
+    m_x.resize(size);
+    m_y.resize(size);
+    m_r.resize(size);
+    m_g.resize(size);
+    m_b.resize(size);
+}
+
+static inline unsigned short read16bits(const unsigned char * data)
+{
+    return static_cast<unsigned short>(data[0] + (data[1]<<8));
+}
+
+PonkParseResult PonkFrameParser::parse(const unsigned char * data,size_t size)
+{
+    m_paths.clear();
+    m_pointCount = 0;
+    if (size < 1) {
+        return PonkParseResult::Empty;
+    }
+
+    size_t offset = 0;
+    while (offset < size) {
+        // Format, meta data count, meta data, point count
+        if (size < offset + 2) {
+            return PonkParseResult::Truncated;
+        }
+        PonkPath path;
+        path.dataFormat = data[offset];
+        path.metaDataCount = data[offset + 1];
+        offset += 2;
+        if (size < offset + path.metaDataCount * sizeof(GeomUdpMetaData) + 2) {
+            return PonkParseResult::Truncated;
+        }
+        path.metaData = reinterpret_cast<const GeomUdpMetaData *>(data + offset);
+        offset += path.metaDataCount * sizeof(GeomUdpMetaData);
+        path.pointCount = read16bits(data + offset);
+        offset += 2;
+
+        const unsigned int pointBytes = bytesPerPoint(path.dataFormat);
+        if (pointBytes == 0) {
+            return PonkParseResult::UnknownDataFormat;
+        }
+        if (size < offset + static_cast<size_t>(path.pointCount) * pointBytes) {
+            return PonkParseResult::Truncated;
+        }
+        path.dataOffset = static_cast<unsigned int>(offset);
+        path.firstPoint = m_pointCount;
+
+        // Decode while the path is still in cache from the bounds check
+        if (path.pointCount > 0) {
+            reservePoints(static_cast<size_t>(m_pointCount) + path.pointCount);
+            const unsigned int first = m_pointCount;
+            const PonkPointArrays out = { &m_x[first], &m_y[first], &m_r[first], &m_g[first], &m_b[first] };
+            if (path.dataFormat == PONK_DATA_FORMAT_XYRGB_U16) {
+                path.nonFiniteValues = ponkDecodeXYRGB_U16(data + offset,path.pointCount,out);
+            } else {
+                path.nonFiniteValues = ponkDecodeXY_F32_RGB_U8(data + offset,path.pointCount,out);
+            }
+        }
+        offset += static_cast<size_t>(path.pointCount) * pointBytes;
+        m_pointCount += path.pointCount;
+        m_paths.push_back(path);
+    }
+    return PonkParseResult::Ok;
+}
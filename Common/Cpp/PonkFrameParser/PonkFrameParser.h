@@ -0,0 +1,72 @@
+#pragma once
+
+/*
+ *  Parsing of complete PONK frames (the data of all chunks, in chunk order), for receivers.
+ *
+ *  A frame is read in a single pass: each path is checked against the remaining frame size and its
+ *  points decoded right away into structure of arrays buffers (one array per component, with the
+ *  SIMD kernels of PonkPointDecode.h), which is what rendering code loops over. Paths are described
+ *  by a flat table pointing into the frame for meta data and into the point arrays for points.
+ *
+ *  The path table and point arrays are kept from one frame to the next and only grow, so once they
+ *  fit the largest frame received, parsing doesn't allocate.
+ */
+
+#include <cstddef>
+#include <vector>
+#include "PonkDefs.h"
+
+// What PonkFrameParser::parse found in a frame
+enum class PonkParseResult
+{
+    Ok,
+    Empty,              // Frame has no data
+    Truncated,          // Frame ends in the middle of a path, paths before it were parsed
+    UnknownDataFormat   // Path with a data format this parser doesn't decode, paths before it were parsed
+};
+
+// A path of the last parsed frame
+struct PonkPath
+{
+    unsigned char           dataFormat = 0;         // As sent, points are decoded to the same arrays whatever the format
+    const GeomUdpMetaData * metaData = nullptr;     // Points into the frame data, only valid as long as it is
+    unsigned int            metaDataCount = 0;
+    unsigned int            dataOffset = 0;         // Offset of the first point in the frame data
+    unsigned int            firstPoint = 0;         // Index of the first point in the point arrays
+    unsigned int            pointCount = 0;
+    unsigned int            nonFiniteValues = 0;    // NaN or infinite coordinates sent, decoded as 0 (NaN) or clamped
+};
+
+class PonkFrameParser
+{
+public:
+    PonkFrameParser();
+    ~PonkFrameParser();
+
+    // Parse a frame, replacing the paths and points of the previous one
+    PonkParseResult parse(const unsigned char * data,size_t size);
+
+    const std::vector<PonkPath> & paths() const { return m_paths; }
+
+    // Points of all paths, back to back. Positions in [-1,1], colors in [0,1] (see PonkPointDecode.h)
+    unsigned int pointCount() const { return m_pointCount; }
+    const float * x() const { return m_x.data(); }
+    const float * y() const { return m_y.data(); }
+    const float * r() const { return m_r.data(); }
+    const float * g() const { return m_g.data(); }
+    const float * b() const { return m_b.data(); }
+
+    // Bytes of a point in the frame data, 0 for formats this parser doesn't decode
+    static unsigned int bytesPerPoint(unsigned char dataFormat);
+
+private:
+    void reservePoints(size_t count);
+
+    std::vector<PonkPath> m_paths;
+    unsigned int m_pointCount = 0;
+    std::vector<float> m_x;
+    std::vector<float> m_y;
+    std::vector<float> m_r;
+    std::vector<float> m_g;
+    std::vector<float> m_b;
+};
@@ -0,0 +1,354 @@
+#include "PonkPointDecode.h"
+#include <cstring>
+
+#ifdef PONK_DECODE_SSE2
+    #include <emmintrin.h>
+#endif
+#if defined(PONK_DECODE_SSE41) || defined(PONK_DECODE_AVX2)
+    #include <immintrin.h>
+#endif
+
+#ifdef PONK_DECODE_RUNTIME
+    #define PONK_DECODE_TARGET_SSE41 __attribute__((target("sse4.1")))
+    #define PONK_DECODE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+    #define PONK_DECODE_TARGET_SSE41
+    #define PONK_DECODE_TARGET_AVX2
+#endif
+
+// Multiplications rather than divisions, SIMD kernels use the same constants to get the same results
+static const float s_u16PositionScale = 2.f / 65535.f;
+static const float s_u16ColorScale = 1.f / 65535.f;
+static const float s_u8ColorScale = 1.f / 255.f;
+
+static inline PonkPointArrays advance(const PonkPointArrays & out,unsigned int count)
+{
+    PonkPointArrays result = { out.x + count, out.y + count, out.r + count, out.g + count, out.b + count };
+    return result;
+}
+
+static inline unsigned short read16bits(const unsigned char * data)
+{
+    return static_cast<unsigned short>(data[0] + (data[1]<<8));
+}
+
+static inline float clampPosition(float value)
+{
+    return value < -1.f ? -1.f : (value > 1.f ? 1.f : value);
+}
+
+static inline float clampColor(float value)
+{
+    return value > 1.f ? 1.f : value;
+}
+
+// Bits are tested rather than the value, so it still works when built with fast math
+static inline float decodePosition(const unsigned char * data,unsigned int & nonFinite)
+{
+    float value;
+    unsigned int bits;
+    memcpy(&value,data,sizeof(value));
+    memcpy(&bits,data,sizeof(bits));
+    if ((bits & 0x7f800000u) == 0x7f800000u) {
+        nonFinite++;
+        if ((bits & 0x7fffffffu) > 0x7f800000u) {
+            value = 0.f; // NaN
+        }
+    }
+    return clampPosition(value);
+}
+
+unsigned int ponkDecodeXYRGB_U16Scalar(const unsigned char * data,unsigned int count,const PonkPointArrays & out)
+{
+    for (unsigned int i=0; i<count; i++,data+=10) {
+        out.x[i] = clampPosition(read16bits(data) * s_u16PositionScale - 1.f);
+        out.y[i] = clampPosition(read16bits(data + 2) * s_u16PositionScale - 1.f);
+        out.r[i] = clampColor(read16bits(data + 4) * s_u16ColorScale);
+        out.g[i] = clampColor(read16bits(data + 6) * s_u16ColorScale);
+        out.b[i] = clampColor(read16bits(data + 8) * s_u16ColorScale);
+    }
+    return 0;
+}
+
+unsigned int ponkDecodeXY_F32_RGB_U8Scalar(const unsigned char * data,unsigned int count,const PonkPointArrays & out)
+{
+    unsigned int nonFinite = 0;
+    for (unsigned int i=0; i<count; i++,data+=11) {
+        out.x[i] = decodePosition(data,nonFinite);
+        out.y[i] = decodePosition(data + 4,nonFinite);
+        out.r[i] = clampColor(data[8] * s_u8ColorScale);
+        out.g[i] = clampColor(data[9] * s_u8ColorScale);
+        out.b[i] = clampColor(data[10] * s_u8ColorScale);
+    }
+    return nonFinite;
+}
+
+#ifdef PONK_DECODE_SSE2
+static inline unsigned int sumLanes(__m128i values)
+{
+    values = _mm_add_epi32(values,_mm_shuffle_epi32(values,_MM_SHUFFLE(1,0,3,2)));
+    values = _mm_add_epi32(values,_mm_shuffle_epi32(values,_MM_SHUFFLE(2,3,0,1)));
+    return static_cast<unsigned int>(_mm_cvtsi128_si32(values));
+}
+
+unsigned int ponkDecodeXY_F32_RGB_U8Sse2(const unsigned char * data,unsigned int count,const PonkPointArrays & out)
+{
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 minusOne = _mm_set1_ps(-1.f);
+    const __m128 colorScale = _mm_set1_ps(s_u8ColorScale);
+    const __m128i exponent = _mm_set1_epi32(0x7f800000);
+    const __m128i byteMask = _mm_set1_epi32(0xFF);
+    __m128i nonFinite = _mm_setzero_si128();
+    unsigned int i = 0;
+    // Each point is loaded with the 5 bytes following it, the last load must stay inside the path
+    for (; i+5<=count; i+=4) {
+        const unsigned char * p = data + i * 11;
+        const __m128 p0 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));        // x0 y0 c0 -
+        const __m128 p1 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 11)));
+        const __m128 p2 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 22)));
+        const __m128 p3 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 33)));
+        const __m128 t0 = _mm_unpacklo_ps(p0,p1);  // x0 x1 y0 y1
+        const __m128 t1 = _mm_unpacklo_ps(p2,p3);  // x2 x3 y2 y3
+        const __m128 t2 = _mm_unpackhi_ps(p0,p1);  // c0 c1 - -
+        const __m128 t3 = _mm_unpackhi_ps(p2,p3);  // c2 c3 - -
+        __m128 x = _mm_shuffle_ps(t0,t1,_MM_SHUFFLE(1,0,1,0));
+        __m128 y = _mm_shuffle_ps(t0,t1,_MM_SHUFFLE(3,2,3,2));
+        const __m128i colors = _mm_castps_si128(_mm_shuffle_ps(t2,t3,_MM_SHUFFLE(1,0,1,0)));
+
+        // All exponent bits set: NaN or infinite, each such lane is -1
+        nonFinite = _mm_sub_epi32(nonFinite,_mm_cmpeq_epi32(_mm_and_si128(_mm_castps_si128(x),exponent),exponent));
+        nonFinite = _mm_sub_epi32(nonFinite,_mm_cmpeq_epi32(_mm_and_si128(_mm_castps_si128(y),exponent),exponent));
+        x = _mm_and_ps(x,_mm_cmpord_ps(x,x));
+        y = _mm_and_ps(y,_mm_cmpord_ps(y,y));
+        _mm_storeu_ps(out.x + i,_mm_min_ps(_mm_max_ps(x,minusOne),one));
+        _mm_storeu_ps(out.y + i,_mm_min_ps(_mm_max_ps(y,minusOne),one));
+
+        _mm_storeu_ps(out.r + i,_mm_min_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(colors,byteMask)),colorScale),one));
+        _mm_storeu_ps(out.g + i,_mm_min_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(colors,8),byteMask)),colorScale),one));
+        _mm_storeu_ps(out.b + i,_mm_min_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(colors,16),byteMask)),colorScale),one));
+    }
+    return sumLanes(nonFinite) + ponkDecodeXY_F32_RGB_U8Scalar(data + i * 11,count - i,advance(out,i));
+}
+#endif
+
+#ifdef PONK_DECODE_SSE41
+// pshufb masks gathering component c of 8 XYRGB_U16 points from the 5 registers holding them
+struct U16ShuffleMasks
+{
+    unsigned char bytes[5][5][16];  // [component][register]
+};
+
+static U16ShuffleMasks buildU16ShuffleMasks()
+{
+    U16ShuffleMasks masks;
+    memset(&masks,0x80,sizeof(masks)); // High bit set: pshufb writes zero
+    for (unsigned int component=0; component<5; component++) {
+        for (unsigned int point=0; point<8; point++) {
+            const unsigned int index = point * 5 + component;
+            masks.bytes[component][index / 8][point * 2] = static_cast<unsigned char>((index % 8) * 2);
+            masks.bytes[component][index / 8][point * 2 + 1] = static_cast<unsigned char>((index % 8) * 2 + 1);
+        }
+    }
+    return masks;
+}
+
+static const U16ShuffleMasks & u16ShuffleMasks()
+{
+    static const U16ShuffleMasks masks = buildU16ShuffleMasks();
+    return masks;
+}
+
+PONK_DECODE_TARGET_SSE41
+unsigned int ponkDecodeXYRGB_U16Sse41(const unsigned char * data,unsigned int count,const PonkPointArrays & out)
+{
+    const U16ShuffleMasks & masks = u16ShuffleMasks();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 minusOne = _mm_set1_ps(-1.f);
+    const __m128 positionScale = _mm_set1_ps(s_u16PositionScale);
+    const __m128 colorScale = _mm_set1_ps(s_u16ColorScale);
+    float * const outputs[5] = { out.x, out.y, out.r, out.g, out.b };
+    unsigned int i = 0;
+    for (; i+8<=count; i+=8) {
+        const unsigned char * p = data + i * 10;
+        __m128i registers[5];
+        for (int k=0; k<5; k++) {
+            registers[k] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + k * 16));
+        }
+        for (int component=0; component<5; component++) {
+            __m128i values = _mm_setzero_si128();
+            for (int k=0; k<5; k++) {
+                const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i *>(masks.bytes[component][k]));
+                values = _mm_or_si128(values,_mm_shuffle_epi8(registers[k],mask));
+            }
+            __m128 low = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(values));
+            __m128 high = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(values,8)));
+            if (component < 2) {
+                low = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_mul_ps(low,positionScale),one),minusOne),one);
+                high = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_mul_ps(high,positionScale),one),minusOne),one);
+            } else {
+                low = _mm_min_ps(_mm_mul_ps(low,colorScale),one);
+                high = _mm_min_ps(_mm_mul_ps(high,colorScale),one);
+            }
+            _mm_storeu_ps(outputs[component] + i,low);
+            _mm_storeu_ps(outputs[component] + i + 4,high);
+        }
+    }
+    return ponkDecodeXYRGB_U16Scalar(data + i * 10,count - i,advance(out,i));
+}
+#endif
+
+#ifdef PONK_DECODE_AVX2
+// Each 128 bits lane holds the same component of 8 points: lanes are decoded like the SSE4.1 kernel does
+PONK_DECODE_TARGET_AVX2
+unsigned int ponkDecodeXYRGB_U16Avx2(const unsigned char * data,unsigned int count,const PonkPointArrays & out)
+{
+    const U16ShuffleMasks & masks = u16ShuffleMasks();
+    __m256i shuffles[5][5];
+    for (int component=0; component<5; component++) {
+        for (int k=0; k<5; k++) {
+            shuffles[component][k] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(masks.bytes[component][k])));
+        }
+    }
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 minusOne = _mm256_set1_ps(-1.f);
+    const __m256 positionScale = _mm256_set1_ps(s_u16PositionScale);
+    const __m256 colorScale = _mm256_set1_ps(s_u16ColorScale);
+    float * const outputs[5] = { out.x, out.y, out.r, out.g, out.b };
+    unsigned int i = 0;
+    for (; i+16<=count; i+=16) {
+        const unsigned char * p = data + i * 10;
+        __m256i registers[5];
+        for (int k=0; k<5; k++) {
+            const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + k * 16));         // Points 0 to 7
+            const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 80 + k * 16));   // Points 8 to 15
+            registers[k] = _mm256_inserti128_si256(_mm256_castsi128_si256(low),high,1);
+        }
+        for (int component=0; component<5; component++) {
+            __m256i values = _mm256_setzero_si256();
+            for (int k=0; k<5; k++) {
+                values = _mm256_or_si256(values,_mm256_shuffle_epi8(registers[k],shuffles[component][k]));
+            }
+            __m256 low = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(values)));
+            __m256 high = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(values,1)));
+            if (component < 2) {
+                low = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_mul_ps(low,positionScale),one),minusOne),one);
+                high = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_mul_ps(high,positionScale),one),minusOne),one);
+            } else {
+                low = _mm256_min_ps(_mm256_mul_ps(low,colorScale),one);
+                high = _mm256_min_ps(_mm256_mul_ps(high,colorScale),one);
+            }
+            _mm256_storeu_ps(outputs[component] + i,low);
+            _mm256_storeu_ps(outputs[component] + i + 8,high);
+        }
+    }
+    return ponkDecodeXYRGB_U16Sse41(data + i * 10,count - i,advance(out,i));
+}
+
+// Points i and i+4 share a register, one per 128 bits lane: transposing lanes gives 8 points in order
+PONK_DECODE_TARGET_AVX2
+unsigned int ponkDecodeXY_F32_RGB_U8Avx2(const unsigned char * data,unsigned int count,const PonkPointArrays & out)
+{
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 minusOne = _mm256_set1_ps(-1.f);
+    const __m256 colorScale = _mm256_set1_ps(s_u8ColorScale);
+    const __m256i exponent = _mm256_set1_epi32(0x7f800000);
+    const __m256i byteMask = _mm256_set1_epi32(0xFF);
+    __m256i nonFinite = _mm256_setzero_si256();
+    unsigned int i = 0;
+    // Each point is loaded with the 5 bytes following it, the last load must stay inside the path
+    for (; i+9<=count; i+=8) {
+        const unsigned char * p = data + i * 11;
+        __m256 points[4];
+        for (int k=0; k<4; k++) {
+            const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + k * 11));
+            const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + (k + 4) * 11));
+            points[k] = _mm256_castsi256_ps(_mm256_inserti128_si256(_mm256_castsi128_si256(low),high,1));
+        }
+        const __m256 t0 = _mm256_unpacklo_ps(points[0],points[1]);
+        const __m256 t1 = _mm256_unpacklo_ps(points[2],points[3]);
+        const __m256 t2 = _mm256_unpackhi_ps(points[0],points[1]);
+        const __m256 t3 = _mm256_unpackhi_ps(points[2],points[3]);
+        __m256 x = _mm256_shuffle_ps(t0,t1,_MM_SHUFFLE(1,0,1,0));
+        __m256 y = _mm256_shuffle_ps(t0,t1,_MM_SHUFFLE(3,2,3,2));
+        const __m256i colors = _mm256_castps_si256(_mm256_shuffle_ps(t2,t3,_MM_SHUFFLE(1,0,1,0)));
+
+        nonFinite = _mm256_sub_epi32(nonFinite,_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_castps_si256(x),exponent),exponent));
+        nonFinite = _mm256_sub_epi32(nonFinite,_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_castps_si256(y),exponent),exponent));
+        x = _mm256_and_ps(x,_mm256_cmp_ps(x,x,_CMP_ORD_Q));
+        y = _mm256_and_ps(y,_mm256_cmp_ps(y,y,_CMP_ORD_Q));
+        _mm256_storeu_ps(out.x + i,_mm256_min_ps(_mm256_max_ps(x,minusOne),one));
+        _mm256_storeu_ps(out.y + i,_mm256_min_ps(_mm256_max_ps(y,minusOne),one));
+
+        _mm256_storeu_ps(out.r + i,_mm256_min_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(colors,byteMask)),colorScale),one));
+        _mm256_storeu_ps(out.g + i,_mm256_min_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(colors,8),byteMask)),colorScale),one));
+        _mm256_storeu_ps(out.b + i,_mm256_min_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(colors,16),byteMask)),colorScale),one));
+    }
+    const __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(nonFinite),_mm256_extracti128_si256(nonFinite,1));
+    return sumLanes(sum) + ponkDecodeXY_F32_RGB_U8Sse2(data + i * 11,count - i,advance(out,i));
+}
+#endif
+
+bool ponkDecodeHasSse41()
+{
+#if defined(PONK_DECODE_RUNTIME)
+    static const bool hasSse41 = __builtin_cpu_supports("sse4.1") != 0;
+    return hasSse41;
+#elif defined(PONK_DECODE_SSE41)
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool ponkDecodeHasAvx2()
+{
+#if defined(PONK_DECODE_RUNTIME)
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2") != 0;
+    return hasAvx2;
+#elif defined(PONK_DECODE_AVX2)
+    return true;
+#else
+    return false;
+#endif
+}
+
+static PonkPointDecoder selectXYRGB_U16Decoder()
+{
+#ifdef PONK_DECODE_AVX2
+    if (ponkDecodeHasAvx2()) {
+        return &ponkDecodeXYRGB_U16Avx2;
+    }
+#endif
+#ifdef PONK_DECODE_SSE41
+    if (ponkDecodeHasSse41()) {
+        return &ponkDecodeXYRGB_U16Sse41;
+    }
+#endif
+    return &ponkDecodeXYRGB_U16Scalar;
+}
+
+static PonkPointDecoder selectXY_F32_RGB_U8Decoder()
+{
+#ifdef PONK_DECODE_AVX2
+    if (ponkDecodeHasAvx2()) {
+        return &ponkDecodeXY_F32_RGB_U8Avx2;
+    }
+#endif
+#ifdef PONK_DECODE_SSE2
+    return &ponkDecodeXY_F32_RGB_U8Sse2;
+#else
+    return &ponkDecodeXY_F32_RGB_U8Scalar;
+#endif
+}
+
+unsigned int ponkDecodeXYRGB_U16(const unsigned char * data,unsigned int count,const PonkPointArrays & out)
+{
+    static const PonkPointDecoder decoder = selectXYRGB_U16Decoder();
+    return decoder(data,count,out);
+}
+
+unsigned int ponkDecodeXY_F32_RGB_U8(const unsigned char * data,unsigned int count,const PonkPointArrays & out)
+{
+    static const PonkPointDecoder decoder = selectXY_F32_RGB_U8Decoder();
+    return decoder(data,count,out);
+}
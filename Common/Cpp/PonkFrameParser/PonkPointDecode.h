@@ -0,0 +1,65 @@
+#pragma once
+
+/*
+ *  Decoding of PONK path points to structure of arrays floats, used by PonkFrameParser.
+ *
+ *  Positions are decoded to [-1,1] and colors to [0,1], values out of range are clamped in the same
+ *  pass. Float positions that are NaN or infinite are counted: NaN is replaced by 0 (center of the
+ *  projection) and infinities are clamped like other out of range values.
+ *
+ *  Each format has a scalar kernel and SIMD ones, which give the same results to the bit:
+ *      - XYRGB_U16 (10 bytes per point): 8 points loaded as 5 registers, components gathered with
+ *        pshufb (SSE4.1), or 16 points with each 128 bits lane handling 8 of them (AVX2)
+ *      - XY_F32_RGB_U8 (11 bytes per point): 4 points loaded one per register, transposed so each
+ *        register holds one component (SSE2), or 8 points with two per register (AVX2)
+ *  Like PonkChecksum.h, SSE4.1 and AVX2 are picked at run time with GCC and Clang, and at compile
+ *  time with MSVC (/arch:AVX2). Other CPUs use the scalar kernels.
+ */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define PONK_DECODE_SSE2
+    #if defined(__AVX2__)
+        #define PONK_DECODE_SSE41
+        #define PONK_DECODE_AVX2
+    #elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+        #define PONK_DECODE_SSE41
+        #define PONK_DECODE_AVX2
+        #define PONK_DECODE_RUNTIME
+    #elif defined(__SSE4_1__)
+        #define PONK_DECODE_SSE41
+    #endif
+#endif
+
+// Destination of decoded points, count floats are written to each array
+struct PonkPointArrays
+{
+    float * x;
+    float * y;
+    float * r;
+    float * g;
+    float * b;
+};
+
+// Decode count points of data, return the number of NaN or infinite coordinates found
+typedef unsigned int (*PonkPointDecoder)(const unsigned char * data,unsigned int count,const PonkPointArrays & out);
+
+// Fastest kernels available on this CPU
+unsigned int ponkDecodeXYRGB_U16(const unsigned char * data,unsigned int count,const PonkPointArrays & out);
+unsigned int ponkDecodeXY_F32_RGB_U8(const unsigned char * data,unsigned int count,const PonkPointArrays & out);
+
+unsigned int ponkDecodeXYRGB_U16Scalar(const unsigned char * data,unsigned int count,const PonkPointArrays & out);
+unsigned int ponkDecodeXY_F32_RGB_U8Scalar(const unsigned char * data,unsigned int count,const PonkPointArrays & out);
+#ifdef PONK_DECODE_SSE2
+unsigned int ponkDecodeXY_F32_RGB_U8Sse2(const unsigned char * data,unsigned int count,const PonkPointArrays & out);
+#endif
+#ifdef PONK_DECODE_SSE41
+unsigned int ponkDecodeXYRGB_U16Sse41(const unsigned char * data,unsigned int count,const PonkPointArrays & out);
+#endif
+#ifdef PONK_DECODE_AVX2
+unsigned int ponkDecodeXYRGB_U16Avx2(const unsigned char * data,unsigned int count,const PonkPointArrays & out);
+unsigned int ponkDecodeXY_F32_RGB_U8Avx2(const unsigned char * data,unsigned int count,const PonkPointArrays & out);
+#endif
+
+// Whether the CPU runs the kernels above, always true for those enabled at compile time
+bool ponkDecodeHasSse41();
+bool ponkDecodeHasAvx2();
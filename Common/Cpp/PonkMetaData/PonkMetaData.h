@@ -0,0 +1,240 @@
+#pragma once
+
+/*
+ *  Path meta data with EightCC keys handled as 64 bits integers, so keys are compared, switched on
+ *  and stored without building strings.
+ *
+ *  The keys documented in PonkDefs.h (MadMapper / MadLaser) have a compile time table giving their
+ *  type and valid range: ponkDecodeMetaData reads them to a typed struct, rounding integers and
+ *  clamping out of range values. Other keys are kept as they are in a small list inside the struct,
+ *  so decoding the meta data of a path never allocates.
+ *
+ *  Header only: also used by the TouchDesigner plugin, which has its own project files.
+ */
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include "PonkDefs.h"
+
+// EightCC as an integer: first character in the low byte, the way it is laid out in packets
+typedef unsigned long long PonkMetaDataKey;
+
+constexpr PonkMetaDataKey ponkEightCC(const char * name,unsigned int index = 0)
+{
+    return index == 8 ? 0 : (static_cast<PonkMetaDataKey>(static_cast<unsigned char>(name[index])) << (8 * index)) | ponkEightCC(name,index + 1);
+}
+
+// Key of a name of any length: shorter names are padded with zeros, longer ones cut to 8 characters
+inline PonkMetaDataKey ponkMetaDataKey(const char * name)
+{
+    char eightCC[8] = {};
+    for (unsigned int i=0; i<sizeof(eightCC) && name[i]; i++) {
+        eightCC[i] = name[i];
+    }
+    return ponkEightCC(eightCC);
+}
+
+// Characters of a key, null terminated
+inline void ponkMetaDataName(PonkMetaDataKey key,char (&name)[9])
+{
+    for (unsigned int i=0; i<8; i++) {
+        name[i] = static_cast<char>((key >> (8 * i)) & 0xFF);
+    }
+    name[8] = 0;
+}
+
+// Meta data documented in PonkDefs.h
+enum class PonkMetaDataId
+{
+    PathNumber,         // PATHNUMB
+    MaxSpeed,           // MAXSPEED
+    SkipBlack,          // SKIPBLCK
+    PreserveOrder,      // PRESRVOR
+    AngleOptimization,  // ANGLEOPT
+    AngleThreshold,     // ANGLETHR
+    AngleMaxDuration,   // ANGLEMXD
+    FirstPointRepeat,   // FRSTPNTR
+    LastPointRepeat,    // LASTPNTR
+    PolygonFadeIn,      // POLYFADI
+    PolygonFadeOut,     // POLYFADO
+    MinimumPoints,      // MINIPNTS
+    SoftClose,          // SOFTCLOS
+    SinglePointPoints,  // SNGLPTIN
+    Count
+};
+
+enum class PonkMetaDataType
+{
+    Integer,    // Rounded to the nearest int
+    Float,
+    Boolean     // Any value but zero is true
+};
+
+struct PonkMetaDataDefinition
+{
+    PonkMetaDataKey     key;
+    PonkMetaDataType    type;
+    float               minimum;
+    float               maximum;
+};
+
+#define PONK_META_DATA_FLOAT_MAX std::numeric_limits<float>::max()
+
+// Indexed by PonkMetaDataId
+constexpr PonkMetaDataDefinition PonkMetaDataDefinitions[] = {
+    { ponkEightCC("PATHNUMB"), PonkMetaDataType::Integer, -16777216.f, 16777216.f },  // Integers a float holds exactly
+    { ponkEightCC("MAXSPEED"), PonkMetaDataType::Float, 0.f, PONK_META_DATA_FLOAT_MAX },
+    { ponkEightCC("SKIPBLCK"), PonkMetaDataType::Boolean, -PONK_META_DATA_FLOAT_MAX, PONK_META_DATA_FLOAT_MAX },
+    { ponkEightCC("PRESRVOR"), PonkMetaDataType::Boolean, -PONK_META_DATA_FLOAT_MAX, PONK_META_DATA_FLOAT_MAX },
+    { ponkEightCC("ANGLEOPT"), PonkMetaDataType::Boolean, -PONK_META_DATA_FLOAT_MAX, PONK_META_DATA_FLOAT_MAX },
+    { ponkEightCC("ANGLETHR"), PonkMetaDataType::Float, 22.5f, 90.f },
+    { ponkEightCC("ANGLEMXD"), PonkMetaDataType::Float, 0.f, PONK_META_DATA_FLOAT_MAX },
+    { ponkEightCC("FRSTPNTR"), PonkMetaDataType::Integer, 0.f, 65535.f },
+    { ponkEightCC("LASTPNTR"), PonkMetaDataType::Integer, 0.f, 65535.f },
+    { ponkEightCC("POLYFADI"), PonkMetaDataType::Float, 0.f, 8.f },
+    { ponkEightCC("POLYFADO"), PonkMetaDataType::Float, 0.f, 0.1f },
+    { ponkEightCC("MINIPNTS"), PonkMetaDataType::Integer, 0.f, 65535.f },
+    { ponkEightCC("SOFTCLOS"), PonkMetaDataType::Integer, 0.f, 65535.f },
+    { ponkEightCC("SNGLPTIN"), PonkMetaDataType::Integer, 0.f, 65535.f }
+};
+static_assert(sizeof(PonkMetaDataDefinitions) / sizeof(PonkMetaDataDefinitions[0]) == static_cast<size_t>(PonkMetaDataId::Count),
+              "One definition per PonkMetaDataId");
+
+#undef PONK_META_DATA_FLOAT_MAX
+
+// Documented meta data of a key, PonkMetaDataId::Count for other keys
+inline PonkMetaDataId ponkMetaDataId(PonkMetaDataKey key)
+{
+    switch (key) {
+        case ponkEightCC("PATHNUMB"): return PonkMetaDataId::PathNumber;
+        case ponkEightCC("MAXSPEED"): return PonkMetaDataId::MaxSpeed;
+        case ponkEightCC("SKIPBLCK"): return PonkMetaDataId::SkipBlack;
+        case ponkEightCC("PRESRVOR"): return PonkMetaDataId::PreserveOrder;
+        case ponkEightCC("ANGLEOPT"): return PonkMetaDataId::AngleOptimization;
+        case ponkEightCC("ANGLETHR"): return PonkMetaDataId::AngleThreshold;
+        case ponkEightCC("ANGLEMXD"): return PonkMetaDataId::AngleMaxDuration;
+        case ponkEightCC("FRSTPNTR"): return PonkMetaDataId::FirstPointRepeat;
+        case ponkEightCC("LASTPNTR"): return PonkMetaDataId::LastPointRepeat;
+        case ponkEightCC("POLYFADI"): return PonkMetaDataId::PolygonFadeIn;
+        case ponkEightCC("POLYFADO"): return PonkMetaDataId::PolygonFadeOut;
+        case ponkEightCC("MINIPNTS"): return PonkMetaDataId::MinimumPoints;
+        case ponkEightCC("SOFTCLOS"): return PonkMetaDataId::SoftClose;
+        case ponkEightCC("SNGLPTIN"): return PonkMetaDataId::SinglePointPoints;
+        default: return PonkMetaDataId::Count;
+    }
+}
+
+// Up to this many keys of a path that are not documented are kept, the next ones are only counted
+#define PONK_META_DATA_MAX_UNKNOWN 8
+
+// Meta data of a path. Fields of documented keys the path doesn't have keep neutral defaults, has() tells them apart
+struct PonkPathMetaData
+{
+    unsigned int    present = 0;        // One bit per PonkMetaDataId found
+    unsigned int    outOfRange = 0;     // One bit per PonkMetaDataId clamped, or ignored (NaN)
+
+    int             pathNumber = 0;
+    float           maxSpeed = 1.f;
+    bool            skipBlack = false;
+    bool            preserveOrder = false;
+    bool            angleOptimization = false;
+    float           angleThreshold = 22.5f;
+    float           angleMaxDuration = 0.f;
+    int             firstPointRepeat = 0;
+    int             lastPointRepeat = 0;
+    float           polygonFadeIn = 0.f;
+    float           polygonFadeOut = 0.f;
+    int             minimumPoints = 0;
+    int             softClose = 0;
+    int             singlePointPoints = 0;
+
+    struct Unknown
+    {
+        PonkMetaDataKey key;
+        float           value;
+    };
+    unsigned int    unknownCount = 0;
+    Unknown         unknown[PONK_META_DATA_MAX_UNKNOWN];
+    unsigned int    unknownDropped = 0;
+
+    bool has(PonkMetaDataId id) const { return (present & (1u << static_cast<unsigned int>(id))) != 0; }
+};
+
+// Decode the meta data of a path, as they come in a packet (see PonkPath::metaData)
+inline void ponkDecodeMetaData(const GeomUdpMetaData * metaData,unsigned int count,PonkPathMetaData & decoded)
+{
+    decoded = PonkPathMetaData();
+    for (unsigned int i=0; i<count; i++) {
+        const PonkMetaDataKey key = ponkEightCC(metaData[i].name);
+        float value;
+        memcpy(&value,metaData[i].value,sizeof(value));
+
+        const PonkMetaDataId id = ponkMetaDataId(key);
+        if (id == PonkMetaDataId::Count) {
+            if (decoded.unknownCount < PONK_META_DATA_MAX_UNKNOWN) {
+                decoded.unknown[decoded.unknownCount].key = key;
+                decoded.unknown[decoded.unknownCount].value = value;
+                decoded.unknownCount++;
+            } else {
+                decoded.unknownDropped++;
+            }
+            continue;
+        }
+
+        const unsigned int bit = 1u << static_cast<unsigned int>(id);
+        const PonkMetaDataDefinition & definition = PonkMetaDataDefinitions[static_cast<unsigned int>(id)];
+        if (std::isnan(value)) {
+            decoded.outOfRange |= bit;
+            continue;
+        }
+        if (value < definition.minimum || value > definition.maximum) {
+            decoded.outOfRange |= bit;
+            value = value < definition.minimum ? definition.minimum : definition.maximum;
+        }
+        decoded.present |= bit;
+
+        const int integer = static_cast<int>(std::lround(value));
+        const bool boolean = value != 0.f;
+        switch (id) {
+            case PonkMetaDataId::PathNumber: decoded.pathNumber = integer; break;
+            case PonkMetaDataId::MaxSpeed: decoded.maxSpeed = value; break;
+            case PonkMetaDataId::SkipBlack: decoded.skipBlack = boolean; break;
+            case PonkMetaDataId::PreserveOrder: decoded.preserveOrder = boolean; break;
+            case PonkMetaDataId::AngleOptimization: decoded.angleOptimization = boolean; break;
+            case PonkMetaDataId::AngleThreshold: decoded.angleThreshold = value; break;
+            case PonkMetaDataId::AngleMaxDuration: decoded.angleMaxDuration = value; break;
+            case PonkMetaDataId::FirstPointRepeat: decoded.firstPointRepeat = integer; break;
+            case PonkMetaDataId::LastPointRepeat: decoded.lastPointRepeat = integer; break;
+            case PonkMetaDataId::PolygonFadeIn: decoded.polygonFadeIn = value; break;
+            case PonkMetaDataId::PolygonFadeOut: decoded.polygonFadeOut = value; break;
+            case PonkMetaDataId::MinimumPoints: decoded.minimumPoints = integer; break;
+            case PonkMetaDataId::SoftClose: decoded.softClose = integer; break;
+            case PonkMetaDataId::SinglePointPoints: decoded.singlePointPoints = integer; break;
+            case PonkMetaDataId::Count: break;
+        }
+    }
+}
+
+// Decoded value of a documented key as a float (integers rounded, booleans 0 or 1)
+inline float ponkMetaDataValue(const PonkPathMetaData & metaData,PonkMetaDataId id)
+{
+    switch (id) {
+        case PonkMetaDataId::PathNumber: return static_cast<float>(metaData.pathNumber);
+        case PonkMetaDataId::MaxSpeed: return metaData.maxSpeed;
+        case PonkMetaDataId::SkipBlack: return metaData.skipBlack ? 1.f : 0.f;
+        case PonkMetaDataId::PreserveOrder: return metaData.preserveOrder ? 1.f : 0.f;
+        case PonkMetaDataId::AngleOptimization: return metaData.angleOptimization ? 1.f : 0.f;
+        case PonkMetaDataId::AngleThreshold: return metaData.angleThreshold;
+        case PonkMetaDataId::AngleMaxDuration: return metaData.angleMaxDuration;
+        case PonkMetaDataId::FirstPointRepeat: return static_cast<float>(metaData.firstPointRepeat);
+        case PonkMetaDataId::LastPointRepeat: return static_cast<float>(metaData.lastPointRepeat);
+        case PonkMetaDataId::PolygonFadeIn: return metaData.polygonFadeIn;
+        case PonkMetaDataId::PolygonFadeOut: return metaData.polygonFadeOut;
+        case PonkMetaDataId::MinimumPoints: return static_cast<float>(metaData.minimumPoints);
+        case PonkMetaDataId::SoftClose: return static_cast<float>(metaData.softClose);
+        case PonkMetaDataId::SinglePointPoints: return static_cast<float>(metaData.singlePointPoints);
+        case PonkMetaDataId::Count: break;
+    }
+    return 0.f;
+}
@@ -0,0 +1,298 @@
+#include "PonkReceiverStats.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "DatagramSocket/DatagramSocket.h"
+
+static inline unsigned int highestBit(unsigned long long value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index,value);
+    return index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+unsigned long long PonkHistogramSnapshot::count() const
+{
+    unsigned long long total = 0;
+    for (unsigned long long bucketCount: counts) {
+        total += bucketCount;
+    }
+    return total;
+}
+
+unsigned long long PonkHistogramSnapshot::percentile(double fraction) const
+{
+    const unsigned long long total = count();
+    if (total == 0) {
+        return 0;
+    }
+    const double rank = std::ceil(fraction * static_cast<double>(total));
+    const unsigned long long target = (std::max)(1ull,(std::min)(total,static_cast<unsigned long long>(rank)));
+    unsigned long long cumulated = 0;
+    for (size_t i=0; i<counts.size(); i++) {
+        cumulated += counts[i];
+        if (cumulated >= target) {
+            return PonkLatencyHistogram::bucketUpperBound(static_cast<unsigned int>(i));
+        }
+    }
+    return 0;
+}
+
+PonkHistogramSnapshot PonkHistogramSnapshot::since(const PonkHistogramSnapshot & previous) const
+{
+    PonkHistogramSnapshot interval = *this;
+    for (size_t i=0; i<interval.counts.size() && i<previous.counts.size(); i++) {
+        interval.counts[i] -= previous.counts[i];
+    }
+    return interval;
+}
+
+PonkLatencyHistogram::PonkLatencyHistogram()
+{
+    for (auto & counter: m_counts) {
+        counter.store(0,std::memory_order_relaxed);
+    }
+}
+
+unsigned int PonkLatencyHistogram::bucketIndex(unsigned long long valueNs)
+{
+    if (valueNs < SubBucketCount) {
+        return static_cast<unsigned int>(valueNs);
+    }
+    // Power of two, then the next SubBucketBits bits
+    const unsigned int bit = highestBit(valueNs);
+    if (bit >= MaxBits) {
+        return BucketCount - 1;
+    }
+    const unsigned int shift = bit - SubBucketBits;
+    return SubBucketCount + shift * SubBucketCount + static_cast<unsigned int>((valueNs >> shift) & (SubBucketCount - 1));
+}
+
+unsigned long long PonkLatencyHistogram::bucketUpperBound(unsigned int index)
+{
+    if (index < SubBucketCount) {
+        return index;
+    }
+    const unsigned int shift = (index - SubBucketCount) / SubBucketCount;
+    const unsigned long long subBucket = (index - SubBucketCount) % SubBucketCount;
+    return ((SubBucketCount + subBucket + 1) << shift) - 1;
+}
+
+void PonkLatencyHistogram::record(unsigned long long valueNs)
+{
+    m_counts[bucketIndex(valueNs)].fetch_add(1,std::memory_order_relaxed);
+}
+
+void PonkLatencyHistogram::snapshot(PonkHistogramSnapshot & snapshot) const
+{
+    snapshot.counts.resize(BucketCount);
+    for (unsigned int i=0; i<BucketCount; i++) {
+        snapshot.counts[i] = m_counts[i].load(std::memory_order_relaxed);
+    }
+}
+
+PonkSenderStats::PonkSenderStats(const PonkSenderKey & key,const char * name)
+    : m_key(key)
+{
+    // Names in chunk headers aren't null terminated when they use all 32 characters
+    strncpy(m_name,name,sizeof(m_name) - 1);
+}
+
+void PonkSenderStats::snapshot(PonkSenderStatsSnapshot & snapshot) const
+{
+    snapshot.sender = m_key;
+    memcpy(snapshot.senderName,m_name,sizeof(snapshot.senderName));
+    snapshot.chunksReceived = m_chunksReceived.load(std::memory_order_relaxed);
+    snapshot.bytesReceived = m_bytesReceived.load(std::memory_order_relaxed);
+    snapshot.chunksDuplicated = m_chunksDuplicated.load(std::memory_order_relaxed);
+    snapshot.chunksLate = m_chunksLate.load(std::memory_order_relaxed);
+    snapshot.chunksLost = m_chunksLost.load(std::memory_order_relaxed);
+    snapshot.framesCompleted = m_framesCompleted.load(std::memory_order_relaxed);
+    snapshot.framesLost = m_framesLost.load(std::memory_order_relaxed);
+    snapshot.crcFailures = m_crcFailures.load(std::memory_order_relaxed);
+    snapshot.unsupportedVersion = m_unsupportedVersion.load(std::memory_order_relaxed);
+    snapshot.framesDecoded = m_framesDecoded.load(std::memory_order_relaxed);
+    snapshot.unsupportedFormat = m_unsupportedFormat.load(std::memory_order_relaxed);
+    m_chunkInterArrival.snapshot(snapshot.chunkInterArrival);
+    m_reassembly.snapshot(snapshot.reassembly);
+    m_decode.snapshot(snapshot.decode);
+}
+
+PonkReceiverStats::PonkReceiverStats(unsigned int maxSenders)
+    : m_senders(new std::unique_ptr<PonkSenderStats>[maxSenders])
+    , m_maxSenders(maxSenders)
+{
+}
+
+PonkReceiverStats::~PonkReceiverStats()
+{
+}
+
+// Senders restarted from another port keep their stats
+static PonkSenderKey statsKey(const PonkSenderKey & key)
+{
+    PonkSenderKey statsKey = key;
+    statsKey.port = 0;
+    return statsKey;
+}
+
+PonkSenderStats * PonkReceiverStats::sender(const PonkSenderKey & key,const char * name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_indices.find(statsKey(key));
+    if (it != m_indices.end()) {
+        return m_senders[it->second].get();
+    }
+    const unsigned int index = m_senderCount.load(std::memory_order_relaxed);
+    if (index >= m_maxSenders) {
+        countSenderRejection();
+        return nullptr;
+    }
+    m_senders[index].reset(new PonkSenderStats(key,name));
+    m_indices.insert(std::make_pair(statsKey(key),index));
+    // Readers see the stats of a sender as soon as they see the sender
+    m_senderCount.store(index + 1,std::memory_order_release);
+    return m_senders[index].get();
+}
+
+PonkSenderStats * PonkReceiverStats::find(const PonkSenderKey & key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_indices.find(statsKey(key));
+    return it != m_indices.end() ? m_senders[it->second].get() : nullptr;
+}
+
+PonkReceiverStatsSnapshot PonkReceiverStats::snapshot() const
+{
+    PonkReceiverStatsSnapshot snapshot;
+    snapshot.timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    snapshot.invalidDatagrams = m_invalidDatagrams.load(std::memory_order_relaxed);
+    snapshot.senderRejections = m_senderRejections.load(std::memory_order_relaxed);
+    snapshot.kernelDrops = m_kernelDrops.load(std::memory_order_relaxed);
+    const unsigned int senderCount = m_senderCount.load(std::memory_order_acquire);
+    snapshot.senders.resize(senderCount);
+    for (unsigned int i=0; i<senderCount; i++) {
+        m_senders[i]->snapshot(snapshot.senders[i]);
+    }
+    return snapshot;
+}
+
+static void appendJsonString(std::string & json,const char * value)
+{
+    json += '"';
+    for (const char * c=value; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            json += '\\';
+            json += *c;
+        } else if (static_cast<unsigned char>(*c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped,sizeof(escaped),"\\u%04x",static_cast<unsigned int>(*c));
+            json += escaped;
+        } else {
+            json += *c;
+        }
+    }
+    json += '"';
+}
+
+static void appendJsonNumber(std::string & json,const char * name,unsigned long long value)
+{
+    json += '"';
+    json += name;
+    json += "\":";
+    json += std::to_string(value);
+    json += ',';
+}
+
+static void appendJsonNumber(std::string & json,const char * name,double value,const char * format)
+{
+    char text[32];
+    snprintf(text,sizeof(text),format,value);
+    json += '"';
+    json += name;
+    json += "\":";
+    json += text;
+    json += ',';
+}
+
+static void appendJsonHistogram(std::string & json,const char * name,const PonkHistogramSnapshot & histogram)
+{
+    json += '"';
+    json += name;
+    json += "\":{";
+    appendJsonNumber(json,"count",histogram.count());
+    appendJsonNumber(json,"p50",histogram.percentile(0.5) / 1000.0,"%.3f");
+    appendJsonNumber(json,"p90",histogram.percentile(0.9) / 1000.0,"%.3f");
+    appendJsonNumber(json,"p99",histogram.percentile(0.99) / 1000.0,"%.3f");
+    appendJsonNumber(json,"p999",histogram.percentile(0.999) / 1000.0,"%.3f");
+    appendJsonNumber(json,"max",histogram.max() / 1000.0,"%.3f");
+    json.back() = '}';
+    json += ',';
+}
+
+std::string ponkReceiverStatsJson(const PonkReceiverStatsSnapshot & snapshot,const PonkReceiverStatsSnapshot * previous)
+{
+    static const PonkSenderStatsSnapshot noSender;
+    const double seconds = previous && snapshot.timestampNs > previous->timestampNs ?
+                           (snapshot.timestampNs - previous->timestampNs) / 1e9 : 0.0;
+    // Rates need an interval, they are 0 in the first line
+    const auto rate = [seconds](unsigned long long current,unsigned long long before) {
+        return seconds > 0 ? (current - before) / seconds : 0.0;
+    };
+
+    std::string json = "{";
+    appendJsonNumber(json,"time_ms",snapshot.timestampNs / 1000000);
+    appendJsonNumber(json,"interval_s",seconds,"%.3f");
+    appendJsonNumber(json,"invalid_datagrams",snapshot.invalidDatagrams);
+    appendJsonNumber(json,"sender_rejections",snapshot.senderRejections);
+    appendJsonNumber(json,"kernel_drops",snapshot.kernelDrops);
+    appendJsonNumber(json,"kernel_drops_per_s",rate(snapshot.kernelDrops,previous ? previous->kernelDrops : 0),"%.1f");
+    json += "\"senders\":[";
+    for (size_t i=0; i<snapshot.senders.size(); i++) {
+        const PonkSenderStatsSnapshot & sender = snapshot.senders[i];
+        // Senders are only added, they keep their index from one snapshot to the next
+        const bool hasBefore = previous && i < previous->senders.size() && previous->senders[i].sender == sender.sender;
+        const PonkSenderStatsSnapshot & before = hasBefore ? previous->senders[i] : noSender;
+
+        json += "{\"ip\":\"" + ipIntToStr(sender.sender.ip) + "\",";
+        appendJsonNumber(json,"port",sender.sender.port);
+        appendJsonNumber(json,"sender_id",sender.sender.senderIdentifier);
+        json += "\"name\":";
+        appendJsonString(json,sender.senderName);
+        json += ',';
+        appendJsonNumber(json,"chunks",sender.chunksReceived);
+        appendJsonNumber(json,"bytes",sender.bytesReceived);
+        appendJsonNumber(json,"chunks_duplicated",sender.chunksDuplicated);
+        appendJsonNumber(json,"chunks_late",sender.chunksLate);
+        appendJsonNumber(json,"chunks_lost",sender.chunksLost);
+        appendJsonNumber(json,"frames",sender.framesCompleted);
+        appendJsonNumber(json,"frames_lost",sender.framesLost);
+        appendJsonNumber(json,"crc_failures",sender.crcFailures);
+        appendJsonNumber(json,"unsupported_version",sender.unsupportedVersion);
+        appendJsonNumber(json,"frames_decoded",sender.framesDecoded);
+        appendJsonNumber(json,"unsupported_format",sender.unsupportedFormat);
+        appendJsonNumber(json,"frames_per_s",rate(sender.framesCompleted,before.framesCompleted),"%.1f");
+        appendJsonNumber(json,"frames_lost_per_s",rate(sender.framesLost,before.framesLost),"%.1f");
+        appendJsonNumber(json,"chunks_lost_per_s",rate(sender.chunksLost,before.chunksLost),"%.1f");
+        appendJsonNumber(json,"bytes_per_s",rate(sender.bytesReceived,before.bytesReceived),"%.0f");
+        appendJsonHistogram(json,"chunk_inter_arrival_us",sender.chunkInterArrival.since(before.chunkInterArrival));
+        appendJsonHistogram(json,"reassembly_us",sender.reassembly.since(before.reassembly));
+        appendJsonHistogram(json,"decode_us",sender.decode.since(before.decode));
+        json.back() = '}';
+        json += ',';
+    }
+    if (json.back() == ',') {
+        json.pop_back();
+    }
+    json += "]}";
+    return json;
+}
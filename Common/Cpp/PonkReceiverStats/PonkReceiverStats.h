@@ -0,0 +1,186 @@
+#pragma once
+
+/*
+ *  Receiver telemetry: per sender counters and latency histograms, updated by the network and render
+ *  threads without locks and read from any thread as a snapshot, or as JSON lines.
+ *
+ *  Counters separate the causes of a missing frame: chunks lost on the way (frames given up with missing
+ *  chunks, frames of which no chunk arrived), corrupted frames (CRC failures), frames this receiver
+ *  can't read (protocol version, data format) and datagrams dropped by the kernel because the receiver
+ *  was too slow. Lost chunks without kernel drops point at the network; kernel drops and growing
+ *  reassembly or decode times point at the host.
+ *
+ *  Latencies go to log-linear histograms (HDR style): 16 buckets per power of two, so any value is known
+ *  within 1/16 whatever its magnitude, from 1 ns to about 18 minutes, in fixed memory. Recording a value
+ *  is a bucket index and a relaxed atomic add.
+ */
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "PonkFrameAssembler/PonkFrameAssembler.h"
+
+// Counts of a histogram at some point in time
+struct PonkHistogramSnapshot
+{
+    std::vector<unsigned long long> counts;     // One per bucket of PonkLatencyHistogram, empty before the first snapshot
+
+    unsigned long long count() const;
+    // Upper bound of the bucket holding the value below which this fraction of the values are, 0 when empty
+    unsigned long long percentile(double fraction) const;
+    unsigned long long max() const { return percentile(1.0); }
+    // Values recorded since an earlier snapshot of the same histogram
+    PonkHistogramSnapshot since(const PonkHistogramSnapshot & previous) const;
+};
+
+// Histogram of durations in nanoseconds, one writer thread, readers on any thread
+class PonkLatencyHistogram
+{
+public:
+    enum {
+        SubBucketBits = 4,
+        SubBucketCount = 1 << SubBucketBits,
+        MaxBits = 40,   // Values from 2^40 ns are counted in the last bucket
+        BucketCount = SubBucketCount + (MaxBits - SubBucketBits) * SubBucketCount
+    };
+
+    PonkLatencyHistogram();
+
+    void record(unsigned long long valueNs);
+    void snapshot(PonkHistogramSnapshot & snapshot) const;
+
+    static unsigned int bucketIndex(unsigned long long valueNs);
+    // Largest value counted in a bucket
+    static unsigned long long bucketUpperBound(unsigned int index);
+
+private:
+    std::atomic<unsigned long long> m_counts[BucketCount];
+};
+
+struct PonkSenderStatsSnapshot
+{
+    PonkSenderKey           sender;                 // Port of the first chunk received
+    char                    senderName[33] = {};    // As in the first chunk received
+    unsigned long long      chunksReceived = 0;     // Including duplicate and late ones
+    unsigned long long      bytesReceived = 0;      // Headers included
+    unsigned long long      chunksDuplicated = 0;
+    unsigned long long      chunksLate = 0;         // Frame already given up
+    unsigned long long      chunksLost = 0;         // Missing from frames given up
+    unsigned long long      framesCompleted = 0;
+    unsigned long long      framesLost = 0;         // Given up with missing chunks, or no chunk of them received
+    unsigned long long      crcFailures = 0;
+    unsigned long long      unsupportedVersion = 0; // Chunks with a protocol version newer than this receiver
+    unsigned long long      framesDecoded = 0;
+    unsigned long long      unsupportedFormat = 0;  // Frames with a path in an unknown data format
+    PonkHistogramSnapshot   chunkInterArrival;      // Between consecutive chunks of the sender
+    PonkHistogramSnapshot   reassembly;             // First to last chunk of completed frames
+    PonkHistogramSnapshot   decode;                 // Parsing of complete frames
+};
+
+struct PonkReceiverStatsSnapshot
+{
+    unsigned long long                      timestampNs = 0;    // Steady clock
+    unsigned long long                      invalidDatagrams = 0;   // Not PONK or inconsistent header, no sender known
+    unsigned long long                      senderRejections = 0;   // Chunks or frames of new senders refused, too many active ones,
+                                                                    // and new senders refused stats, too many known ones
+    unsigned long long                      kernelDrops = 0;
+    std::vector<PonkSenderStatsSnapshot>    senders;
+};
+
+// Counters of a sender. Reception counters and histograms are written by the network thread handling the
+// sender, decode ones by the thread parsing its frames
+class PonkSenderStats
+{
+public:
+    PonkSenderStats(const PonkSenderKey & key,const char * name);
+
+    // Network thread
+    void countChunk(unsigned int bytes) {
+        add(m_chunksReceived,1);
+        add(m_bytesReceived,bytes);
+    }
+    void recordChunkInterArrival(unsigned long long ns) { m_chunkInterArrival.record(ns); }
+    void countDuplicateChunk() { add(m_chunksDuplicated,1); }
+    void countLateChunk() { add(m_chunksLate,1); }
+    void countFrameCompleted() { add(m_framesCompleted,1); }
+    void recordReassembly(unsigned long long ns) { m_reassembly.record(ns); }
+    void countFrameLost(unsigned int missingChunks) {
+        add(m_framesLost,1);
+        add(m_chunksLost,missingChunks);
+    }
+    void countCrcFailure() { add(m_crcFailures,1); }
+    void countUnsupportedVersion() { add(m_unsupportedVersion,1); }
+
+    // Decoding thread
+    void recordDecode(unsigned long long ns) {
+        add(m_framesDecoded,1);
+        m_decode.record(ns);
+    }
+    void countUnsupportedFormat() { add(m_unsupportedFormat,1); }
+
+    const PonkSenderKey & sender() const { return m_key; }
+    void snapshot(PonkSenderStatsSnapshot & snapshot) const;
+
+private:
+    static void add(std::atomic<unsigned long long> & counter,unsigned long long value) {
+        counter.fetch_add(value,std::memory_order_relaxed);
+    }
+
+    PonkSenderKey m_key;
+    char m_name[33] = {};
+    std::atomic<unsigned long long> m_chunksReceived{0};
+    std::atomic<unsigned long long> m_bytesReceived{0};
+    std::atomic<unsigned long long> m_chunksDuplicated{0};
+    std::atomic<unsigned long long> m_chunksLate{0};
+    std::atomic<unsigned long long> m_chunksLost{0};
+    std::atomic<unsigned long long> m_framesCompleted{0};
+    std::atomic<unsigned long long> m_framesLost{0};
+    std::atomic<unsigned long long> m_crcFailures{0};
+    std::atomic<unsigned long long> m_unsupportedVersion{0};
+    std::atomic<unsigned long long> m_framesDecoded{0};
+    std::atomic<unsigned long long> m_unsupportedFormat{0};
+    PonkLatencyHistogram m_chunkInterArrival;
+    PonkLatencyHistogram m_reassembly;
+    PonkLatencyHistogram m_decode;
+};
+
+// Stats of all senders of a receiver, shared by its network threads (see PonkFrameAssembler) and
+// the threads using its frames. Senders are told apart by address and sender identifier, not port: a
+// restarted sender comes back from another port and keeps its stats
+class PonkReceiverStats
+{
+public:
+    explicit PonkReceiverStats(unsigned int maxSenders = 64);
+    ~PonkReceiverStats();
+
+    // Stats of a sender, created on first call, null (and counted as a sender rejection) once maxSenders
+    // senders have stats. Takes a lock: callers on hot paths keep the returned pointer, it stays valid as
+    // long as this object
+    PonkSenderStats * sender(const PonkSenderKey & key,const char * name);
+    // Stats of a sender, null when it has none. Doesn't create them
+    PonkSenderStats * find(const PonkSenderKey & key);
+
+    void countInvalidDatagram() { m_invalidDatagrams.fetch_add(1,std::memory_order_relaxed); }
+    void countSenderRejection() { m_senderRejections.fetch_add(1,std::memory_order_relaxed); }
+    void addKernelDrops(unsigned long long drops) { m_kernelDrops.fetch_add(drops,std::memory_order_relaxed); }
+
+    // Any thread, counters are read one by one: a snapshot taken while receiving isn't atomic as a whole
+    PonkReceiverStatsSnapshot snapshot() const;
+
+private:
+    std::unique_ptr<std::unique_ptr<PonkSenderStats>[]> m_senders;
+    unsigned int m_maxSenders;
+    std::atomic<unsigned int> m_senderCount{0};
+    std::mutex m_mutex;     // Sender creation
+    std::unordered_map<PonkSenderKey,unsigned int,PonkSenderKeyHash> m_indices;
+    std::atomic<unsigned long long> m_invalidDatagrams{0};
+    std::atomic<unsigned long long> m_senderRejections{0};
+    std::atomic<unsigned long long> m_kernelDrops{0};
+};
+
+// A snapshot as a JSON object on a single line: counters since the receiver started, rates and latency
+// percentiles (microseconds) over the interval since previous, since the receiver started without it
+std::string ponkReceiverStatsJson(const PonkReceiverStatsSnapshot & snapshot,const PonkReceiverStatsSnapshot * previous = nullptr);
@@ -0,0 +1,1311 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <string>
+#include <cassert>
+#include <cstring>
+#include <map>
+#include <ctime>
+#include <limits>
+#include "DatagramSocket/DatagramSocket.h"
+#include "PonkChecksum/PonkChecksum.h"
+#include "PonkFrameAssembler/PonkFrameAssembler.h"
+#include "PonkFrameMailbox/PonkFrameMailbox.h"
+#include "PonkFrameParser/PonkFrameParser.h"
+#include "PonkFrameParser/PonkPointDecode.h"
+#include "PonkMetaData/PonkMetaData.h"
+#include "PonkReceiverStats/PonkReceiverStats.h"
+#include "PonkDefs.h"
+
+// Loopback benchmarks for the DatagramSocket send and receive paths.
+// Usage: PonkBenchmark [all|send|recv|zerocopy|pacing|assembler|checksum|parser|decode|mailbox|metadata|stats]
+//        Exits with 1 when a correctness check failed, timings are only printed
+//        PonkBenchmark zerocopy <ip>: zero copy sends timed towards an address reached through a physical network
+//                                     interface. The kernel copies MSG_ZEROCOPY sends delivered locally (loopback,
+//                                     veth pair to another namespace), rows with copied sends are marked void
+
+#define BENCHMARK_PORT 15583
+#define BENCHMARK_RECV_PORT 15584
+#define BENCHMARK_DURATION_MS 2000
+#define LOOPBACK_IP ((127 << 24) + (0 << 16) + (0 << 8) + 1)
+#define ZERO_COPY_THRESHOLD (256 * 1024)
+#define PACING_FRAME_RATE 60
+#define PACING_FRAME_COUNT 120
+#define ASSEMBLER_SENDER_COUNT 12
+#define ASSEMBLER_FRAME_COUNT 2000
+#define CHECKSUM_BUFFER_BYTES (2 * 1024 * 1024)
+#define CHECKSUM_DURATION_MS 500
+#define PARSER_PATH_COUNT 64
+#define PARSER_POINTS_PER_PATH 256
+#define PARSER_DURATION_MS 500
+#define MAILBOX_FRAME_BYTES (64 * 1024)
+#define MAILBOX_DURATION_MS 1000
+#define MAILBOX_SENDER_COUNT 64
+#define MAILBOX_SENDER_IDLE_MS 20
+#define MAILBOX_RESTART_ROUNDS 4
+#define METADATA_DURATION_MS 500
+#define STATS_FRAME_COUNT 100
+#define STATS_DURATION_MS 500
+
+// Correctness checks that failed, main returns 1 when there are some
+static unsigned int failedChecks = 0;
+
+// A serialized frame split in PONK chunks, the way senders do it
+struct BenchmarkFrame {
+    std::vector<unsigned char> fullData;
+    std::vector<GeomUdpHeader> headers;
+    std::vector<DatagramChunk> chunks;
+    std::vector<unsigned char> segmentedData; // Chunks laid out back to back for sendSegmented
+
+    BenchmarkFrame(size_t chunkCount) {
+        fullData.resize(chunkCount * PONK_MAX_DATA_BYTES_PER_PACKET - PONK_MAX_DATA_BYTES_PER_PACKET / 2);
+        for (size_t i=0; i<fullData.size(); i++) {
+            fullData[i] = static_cast<unsigned char>(i * 31 + 7);
+        }
+        const unsigned int dataCrc = ponkChecksum(fullData.data(), fullData.size());
+
+        headers.resize(chunkCount);
+        chunks.resize(chunkCount);
+        size_t written = 0;
+        for (size_t i=0; i<chunkCount; i++) {
+            GeomUdpHeader& header = headers[i];
+            memcpy(header.headerString,PONK_HEADER_STRING,sizeof(header.headerString));
+            header.protocolVersion = 0;
+            header.senderIdentifier = 1;
+            strncpy(header.senderName,"Benchmark",sizeof(header.senderName));
+            header.frameNumber = 0;
+            header.chunkCount = static_cast<unsigned char>(chunkCount);
+            header.chunkNumber = static_cast<unsigned char>(i);
+            header.dataCrc = dataCrc;
+
+            const size_t dataBytesForThisChunk = std::min<size_t>(fullData.size()-written, PONK_MAX_DATA_BYTES_PER_PACKET);
+            chunks[i].header = &header;
+            chunks[i].headerLen = sizeof(GeomUdpHeader);
+            chunks[i].payload = &fullData[written];
+            chunks[i].payloadLen = static_cast<unsigned int>(dataBytesForThisChunk);
+
+            const auto headerBytes = reinterpret_cast<const unsigned char*>(&header);
+            segmentedData.insert(segmentedData.end(), headerBytes, headerBytes + sizeof(GeomUdpHeader));
+            segmentedData.insert(segmentedData.end(), &fullData[written], &fullData[written] + dataBytesForThisChunk);
+            written += dataBytesForThisChunk;
+        }
+    }
+
+    // Expected datagram for chunk i, as it should appear on the wire
+    std::vector<unsigned char> packet(size_t i) const {
+        std::vector<unsigned char> result(chunks[i].headerLen + chunks[i].payloadLen);
+        memcpy(&result[0], chunks[i].header, chunks[i].headerLen);
+        memcpy(&result[chunks[i].headerLen], chunks[i].payload, chunks[i].payloadLen);
+        return result;
+    }
+};
+
+// Receive queue large enough for the biggest frame checked, sent as a single burst
+static DatagramSocketOptions loopbackReceiverOptions() {
+    DatagramSocketOptions options;
+    options.receiveBufferSize = 4 * 1024 * 1024;
+    return options;
+}
+
+// Drains the benchmark port on a thread, counting datagrams and optionally capturing them
+class LoopbackReceiver {
+public:
+    LoopbackReceiver()
+        : m_socket(LOOPBACK_IP, BENCHMARK_PORT, loopbackReceiverOptions())
+    {
+        m_thread = std::thread([this]() { run(); });
+    }
+
+    ~LoopbackReceiver() {
+        m_running = false;
+        m_thread.join();
+    }
+
+    void startCapture() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_captured.clear();
+        m_capturing = true;
+    }
+
+    std::vector<std::vector<unsigned char>> stopCapture(size_t expectedCount) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        while (std::chrono::steady_clock::now() < deadline) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_captured.size() >= expectedCount) {
+                    break;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_capturing = false;
+        return m_captured;
+    }
+
+    unsigned long long datagramCount() const { return m_datagramCount; }
+
+private:
+    void run() {
+        #define BENCHMARK_RECV_BATCH_SIZE 64
+        std::vector<std::vector<unsigned char>> ringStorage(BENCHMARK_RECV_BATCH_SIZE, std::vector<unsigned char>(65536));
+        std::vector<DatagramBuffer> ring(BENCHMARK_RECV_BATCH_SIZE);
+        for (int i=0; i<BENCHMARK_RECV_BATCH_SIZE; i++) {
+            ring[i].buf = &ringStorage[i][0];
+            ring[i].capacity = static_cast<unsigned int>(ringStorage[i].size());
+        }
+
+        while (m_running) {
+            unsigned int receivedCount = 0;
+            if (!m_socket.recvBatch(&ring[0], BENCHMARK_RECV_BATCH_SIZE, receivedCount)) {
+                assert(false);
+                return;
+            }
+            if (receivedCount == 0) {
+                m_socket.waitReadable(10000);
+                continue;
+            }
+            m_datagramCount += receivedCount;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_capturing) {
+                for (unsigned int i=0; i<receivedCount; i++) {
+                    const auto data = static_cast<const unsigned char*>(ring[i].buf);
+                    m_captured.push_back(std::vector<unsigned char>(data, data + ring[i].size));
+                }
+            }
+        }
+    }
+
+    DatagramSocket m_socket;
+    std::thread m_thread;
+    std::atomic<bool> m_running{true};
+    std::atomic<unsigned long long> m_datagramCount{0};
+
+    std::mutex m_mutex;
+    bool m_capturing = false;
+    std::vector<std::vector<unsigned char>> m_captured;
+};
+
+enum class SendMode {
+    SendToLoop,
+    SendToChunk,
+    SendBatch,
+    SendSegmented
+};
+
+static const char* sendModeName(SendMode mode) {
+    switch (mode) {
+        case SendMode::SendToLoop: return "sendTo per chunk (copy)";
+        case SendMode::SendToChunk: return "sendTo per chunk (gather)";
+        case SendMode::SendBatch: return "sendBatch";
+        case SendMode::SendSegmented: return "sendSegmented (GSO)";
+    }
+    return "";
+}
+
+static bool sendFrame(DatagramSocket& socket, SendMode mode, const BenchmarkFrame& frame, unsigned int destinationIp = LOOPBACK_IP) {
+    GenericAddr destAddr;
+    destAddr.family = AF_INET;
+    destAddr.ip = destinationIp;
+    destAddr.port = BENCHMARK_PORT;
+
+    switch (mode) {
+        case SendMode::SendToLoop:
+            // Historical sender behavior: one packet vector and one sendTo per chunk
+            for (const auto& chunk: frame.chunks) {
+                std::vector<unsigned char> packet;
+                packet.resize(chunk.headerLen + chunk.payloadLen);
+                memcpy(&packet[0], chunk.header, chunk.headerLen);
+                memcpy(&packet[chunk.headerLen], chunk.payload, chunk.payloadLen);
+                if (!socket.sendTo(destAddr, &packet[0], static_cast<unsigned int>(packet.size()))) {
+                    return false;
+                }
+            }
+            return true;
+        case SendMode::SendToChunk:
+            // Header and payload handed to the kernel as two iovecs, nothing copied or allocated
+            for (const auto& chunk: frame.chunks) {
+                if (!socket.sendTo(destAddr, chunk)) {
+                    return false;
+                }
+            }
+            return true;
+        case SendMode::SendBatch:
+            return socket.sendBatch(destAddr, &frame.chunks[0], static_cast<unsigned int>(frame.chunks.size()));
+        case SendMode::SendSegmented:
+            return socket.sendSegmented(destAddr, &frame.segmentedData[0], static_cast<unsigned int>(frame.segmentedData.size()),
+                                        sizeof(GeomUdpHeader) + PONK_MAX_DATA_BYTES_PER_PACKET);
+    }
+    return false;
+}
+
+// Check that a mode puts exactly the expected datagrams on the wire
+static bool verifySendMode(LoopbackReceiver& receiver, SendMode mode, const DatagramSocketOptions& options = DatagramSocketOptions(), size_t chunkCount = 8) {
+    DatagramSocket socket(INADDR_ANY, 0, options);
+    const BenchmarkFrame frame(chunkCount);
+
+    receiver.startCapture();
+    sendFrame(socket, mode, frame);
+    socket.waitZeroCopyCompletions(1000000);
+    const auto captured = receiver.stopCapture(frame.chunks.size());
+
+    if (captured.size() != frame.chunks.size()) {
+        std::cout << "  " << sendModeName(mode) << ": received " << captured.size() << " datagrams, expected " << frame.chunks.size() << std::endl;
+        return false;
+    }
+    for (size_t i=0; i<captured.size(); i++) {
+        if (captured[i] != frame.packet(i)) {
+            std::cout << "  " << sendModeName(mode) << ": datagram " << i << " differs from expected chunk" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static void benchmarkSend() {
+    std::cout << "Send benchmark: frames/sec on loopback, 8 and 100 chunks frames" << std::endl;
+
+    LoopbackReceiver receiver;
+    const SendMode modes[] = { SendMode::SendToLoop, SendMode::SendToChunk, SendMode::SendBatch, SendMode::SendSegmented };
+
+    for (auto mode: modes) {
+        if (!verifySendMode(receiver, mode)) {
+            std::cout << "  " << sendModeName(mode) << ": wire output mismatch" << std::endl;
+            failedChecks++;
+        }
+    }
+
+    const size_t chunkCounts[] = { 8, 100 };
+    for (auto chunkCount: chunkCounts) {
+        const BenchmarkFrame frame(chunkCount);
+        for (auto mode: modes) {
+            DatagramSocket socket(INADDR_ANY, 0);
+            const auto datagramsBefore = receiver.datagramCount();
+            const auto start = std::chrono::steady_clock::now();
+            const auto end = start + std::chrono::milliseconds(BENCHMARK_DURATION_MS);
+            unsigned long long frameCount = 0;
+            while (std::chrono::steady_clock::now() < end) {
+                sendFrame(socket, mode, frame);
+                frameCount++;
+            }
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            std::cout << "  " << chunkCount << " chunks, " << sendModeName(mode) << ": "
+                      << static_cast<unsigned long long>(frameCount / seconds) << " frames/s, "
+                      << (receiver.datagramCount() - datagramsBefore) << " / " << frameCount * chunkCount << " datagrams received" << std::endl;
+        }
+    }
+}
+
+// CPU time spent by the calling thread, in nanoseconds
+static unsigned long long threadCpuTimeNs() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return static_cast<unsigned long long>(now.tv_sec) * 1000000000ull + static_cast<unsigned long long>(now.tv_nsec);
+}
+
+// Frames are checked on loopback, then timed towards destinationIp. When the datagrams are delivered locally the kernel
+// copies zero copy sends anyway and the socket falls back to plain copies after the first completion: both rows then
+// time the copy path
+static void benchmarkZeroCopy(unsigned int destinationIp) {
+    std::cout << "Zero copy benchmark: sender CPU time per frame to " << ipIntToStr(destinationIp) << ", copy vs MSG_ZEROCOPY above "
+              << ZERO_COPY_THRESHOLD / 1024 << " KB" << std::endl;
+    if (destinationIp == LOOPBACK_IP) {
+        std::cout << "  Loopback: the kernel copies zero copy sends, the comparison is void. Run \"zerocopy <ip>\" with an address"
+                  << " reached through a physical network interface" << std::endl;
+    }
+
+    LoopbackReceiver receiver;
+    const SendMode modes[] = { SendMode::SendBatch, SendMode::SendSegmented };
+
+    DatagramSocketOptions zeroCopyOptions;
+    zeroCopyOptions.sendBufferSize = 8 * 1024 * 1024;
+    zeroCopyOptions.zeroCopyThreshold = ZERO_COPY_THRESHOLD;
+    for (auto mode: modes) {
+        if (!verifySendMode(receiver, mode, zeroCopyOptions, 40)) {
+            std::cout << "  " << sendModeName(mode) << " zero copy: wire output mismatch" << std::endl;
+            failedChecks++;
+        }
+    }
+
+    const size_t chunkCounts[] = { 16, 100, 255 };
+    for (auto chunkCount: chunkCounts) {
+        const BenchmarkFrame frame(chunkCount);
+        for (auto mode: modes) {
+            for (int zeroCopy=0; zeroCopy<2; zeroCopy++) {
+                DatagramSocketOptions options = zeroCopyOptions;
+                options.zeroCopyThreshold = zeroCopy ? ZERO_COPY_THRESHOLD : 0;
+                DatagramSocket socket(INADDR_ANY, 0, options);
+
+                // Like a real sender, the frame buffer is only reused once the kernel released it
+                const auto cpuStart = threadCpuTimeNs();
+                const auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(BENCHMARK_DURATION_MS);
+                unsigned long long frameCount = 0;
+                while (std::chrono::steady_clock::now() < end) {
+                    sendFrame(socket, mode, frame, destinationIp);
+                    socket.waitZeroCopyCompletions(1000000);
+                    frameCount++;
+                }
+                const auto cpuNs = threadCpuTimeNs() - cpuStart;
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                std::cout << "  " << chunkCount << " chunks (" << frame.fullData.size() / 1024 << " KB), " << sendModeName(mode)
+                          << (zeroCopy ? " zero copy: " : " copy: ") << cpuNs / 1000 / std::max(1ull, frameCount) << " us CPU/frame, "
+                          << frameCount << " frames";
+                if (zeroCopy) {
+                    std::cout << ", " << socket.zeroCopyCopiedCount() << " sends copied by the kernel";
+                    if (socket.zeroCopyCopiedCount() > 0) {
+                        std::cout << " (void: copy path timed)";
+                    }
+                }
+                std::cout << std::endl;
+            }
+        }
+    }
+}
+
+// Send PACING_FRAME_COUNT frames at PACING_FRAME_RATE to a receiver with a small socket queue that
+// spends some time on each batch, like a receiver decoding frames. Returns frames received complete
+static unsigned int sendPacedFrames(size_t chunkCount, bool pacing, unsigned long long& receivedCount, unsigned long long& kernelDrops) {
+    DatagramSocketOptions receiverOptions;
+    receiverOptions.receiveBufferSize = 128 * 1024;
+    receiverOptions.reportKernelDrops = true;
+    DatagramSocket receiverSocket(LOOPBACK_IP, BENCHMARK_RECV_PORT, receiverOptions);
+
+    std::atomic<bool> receiving{true};
+    std::vector<unsigned int> chunksPerFrame(PACING_FRAME_COUNT, 0);
+    std::thread receiver([&]() {
+        std::vector<std::vector<unsigned char>> ringStorage(16, std::vector<unsigned char>(65536));
+        std::vector<DatagramBuffer> ring(16);
+        for (size_t i=0; i<ring.size(); i++) {
+            ring[i].buf = &ringStorage[i][0];
+            ring[i].capacity = static_cast<unsigned int>(ringStorage[i].size());
+        }
+        while (receiving) {
+            unsigned int count = 0;
+            receiverSocket.recvBatch(&ring[0], static_cast<unsigned int>(ring.size()), count);
+            if (count == 0) {
+                receiverSocket.waitReadable(10000);
+                continue;
+            }
+            for (unsigned int i=0; i<count; i++) {
+                const auto header = static_cast<const GeomUdpHeader*>(ring[i].buf);
+                if (ring[i].size >= sizeof(GeomUdpHeader) && header->frameNumber < PACING_FRAME_COUNT) {
+                    chunksPerFrame[header->frameNumber]++;
+                }
+            }
+            receivedCount += count;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    });
+
+    GenericAddr destAddr;
+    destAddr.family = AF_INET;
+    destAddr.ip = LOOPBACK_IP;
+    destAddr.port = BENCHMARK_RECV_PORT;
+    DatagramSocketOptions senderOptions;
+    senderOptions.sendBufferSize = 4 * 1024 * 1024;
+    DatagramSocket socket(INADDR_ANY, 0, senderOptions);
+    BenchmarkFrame frame(chunkCount);
+    if (pacing) {
+        // Spread each frame over 3/4 of the frame interval, at most 8 chunks back to back
+        const unsigned long long frameBytes = chunkCount * sizeof(GeomUdpHeader) + frame.fullData.size();
+        socket.setPacing(frameBytes * PACING_FRAME_RATE * 4 / 3, 8 * (sizeof(GeomUdpHeader) + PONK_MAX_DATA_BYTES_PER_PACKET));
+    }
+
+    auto nextFrameTime = std::chrono::steady_clock::now();
+    for (unsigned char frameNumber=0; frameNumber<PACING_FRAME_COUNT; frameNumber++) {
+        for (auto& header: frame.headers) {
+            header.frameNumber = frameNumber;
+        }
+        socket.sendBatch(destAddr, &frame.chunks[0], static_cast<unsigned int>(frame.chunks.size()));
+        nextFrameTime += std::chrono::microseconds(1000000 / PACING_FRAME_RATE);
+        std::this_thread::sleep_until(nextFrameTime);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    receiving = false;
+    receiver.join();
+
+    kernelDrops = receiverSocket.kernelDropCount();
+    unsigned int completeFrames = 0;
+    for (auto count: chunksPerFrame) {
+        completeFrames += count == chunkCount ? 1 : 0;
+    }
+    return completeFrames;
+}
+
+static void benchmarkPacing() {
+    std::cout << "Pacing benchmark: " << PACING_FRAME_COUNT << " frames at " << PACING_FRAME_RATE
+              << " fps on loopback to a slow receiver with a 128 KB socket queue, bursts vs paced" << std::endl;
+
+    const size_t chunkCounts[] = { 64, 255 };
+    for (auto chunkCount: chunkCounts) {
+        for (int pacing=0; pacing<2; pacing++) {
+            unsigned long long receivedCount = 0;
+            unsigned long long kernelDrops = 0;
+            const auto completeFrames = sendPacedFrames(chunkCount, pacing != 0, receivedCount, kernelDrops);
+            const unsigned long long frameBytes = chunkCount * (sizeof(GeomUdpHeader) + PONK_MAX_DATA_BYTES_PER_PACKET);
+            std::cout << "  " << chunkCount << " chunks, " << (pacing ? "paced" : "bursts") << ": "
+                      << frameBytes * PACING_FRAME_RATE / 1024 << " KB/s offered, "
+                      << completeFrames << " / " << PACING_FRAME_COUNT << " frames complete, "
+                      << receivedCount << " / " << chunkCount * PACING_FRAME_COUNT << " datagrams received, "
+                      << kernelDrops << " dropped by the kernel" << std::endl;
+        }
+    }
+}
+
+// Check that a frame cut in chunks of the given payload sizes, received in reverse order, is rebuilt intact,
+// or dropped when one of its bytes is corrupted after its CRC was computed
+static bool verifyAssembler(const std::vector<unsigned int>& chunkSizes, bool corrupted = false) {
+    std::vector<unsigned char> data;
+    std::vector<std::vector<unsigned char>> packets;
+    for (size_t i=0; i<chunkSizes.size(); i++) {
+        std::vector<unsigned char> packet(sizeof(GeomUdpHeader) + chunkSizes[i]);
+        GeomUdpHeader* header = reinterpret_cast<GeomUdpHeader*>(&packet[0]);
+        memcpy(header->headerString, PONK_HEADER_STRING, sizeof(header->headerString));
+        header->protocolVersion = 0;
+        header->senderIdentifier = 1;
+        header->frameNumber = 0;
+        header->chunkCount = static_cast<unsigned char>(chunkSizes.size());
+        header->chunkNumber = static_cast<unsigned char>(i);
+        header->dataCrc = 0;
+        for (unsigned int j=0; j<chunkSizes[i]; j++) {
+            packet[sizeof(GeomUdpHeader) + j] = static_cast<unsigned char>(data.size() * 13 + 5);
+            data.push_back(packet[sizeof(GeomUdpHeader) + j]);
+        }
+        packets.push_back(packet);
+    }
+    const unsigned int dataCrc = ponkChecksumScalar(data.data(), data.size());
+    for (auto& packet: packets) {
+        reinterpret_cast<GeomUdpHeader*>(&packet[0])->dataCrc = dataCrc;
+    }
+    if (corrupted) {
+        packets[0][sizeof(GeomUdpHeader)]++;
+    }
+
+    bool intact = false;
+    PonkFrameAssembler assembler([&](const PonkFrameAssembler::Frame& completed) {
+        intact = completed.size == data.size() && (data.empty() || memcmp(completed.data, &data[0], data.size()) == 0);
+    });
+    GenericAddr source;
+    source.ip = LOOPBACK_IP;
+    PonkChunkResult result = PonkChunkResult::Invalid;
+    for (size_t i=packets.size(); i>0; i--) {
+        result = assembler.addChunk(source, &packets[i-1][0], static_cast<unsigned int>(packets[i-1].size()));
+    }
+    if (corrupted) {
+        return !intact && result == PonkChunkResult::CrcMismatch && assembler.stats().crcMismatches == 1;
+    }
+    return intact;
+}
+
+// Feed the assembler with chunks of ASSEMBLER_SENDER_COUNT senders interleaved, the first half of each
+// frame arriving after the second half of the next one, and the first chunk of each frame twice
+static void benchmarkAssembler() {
+    std::cout << "Assembler benchmark: " << ASSEMBLER_SENDER_COUNT << " senders, interleaved chunks, overlapping frames and duplicates" << std::endl;
+
+    // Last chunk received first, then chunks of varying sizes (no sender does that, but the protocol allows it)
+    const std::vector<std::vector<unsigned int>> layouts = {
+        { 100, 100, 40 }, { 100, 100, 100 }, { 100, 100, 150 }, { 100, 50, 100, 20 }, { 10, 300, 0, 20 }, { 0 }
+    };
+    for (const auto& layout: layouts) {
+        if (!verifyAssembler(layout)) {
+            std::cout << "  Frame with " << layout.size() << " chunks of varying sizes not rebuilt intact" << std::endl;
+            failedChecks++;
+        }
+    }
+    if (!verifyAssembler({ 100, 100, 40 }, true)) {
+        std::cout << "  Frame with a corrupted byte not dropped" << std::endl;
+        failedChecks++;
+    }
+
+    // Senders past maxSenders are refused while the others are active, as a flood of spoofed ports would be
+    {
+        const BenchmarkFrame frame(1);
+        const std::vector<unsigned char> packet = frame.packet(0);
+        PonkFrameAssembler assembler(nullptr, 16, nullptr, 4);
+        unsigned int accepted = 0;
+        for (unsigned short port=1000; port<1010; port++) {
+            GenericAddr source;
+            source.ip = LOOPBACK_IP;
+            source.port = port;
+            if (assembler.addChunk(source, &packet[0], static_cast<unsigned int>(packet.size())) != PonkChunkResult::TooManySenders) {
+                accepted++;
+            }
+        }
+        if (accepted != 4 || assembler.senderCount() != 4 || assembler.stats().senderRejections != 6) {
+            std::cout << "  Senders past maxSenders not refused" << std::endl;
+            failedChecks++;
+        }
+    }
+
+    const size_t chunkCounts[] = { 1, 2, 8, 100 };
+    for (auto chunkCount: chunkCounts) {
+        const BenchmarkFrame frame(chunkCount);
+        std::vector<std::vector<unsigned char>> packets;
+        for (size_t i=0; i<chunkCount; i++) {
+            packets.push_back(frame.packet(i));
+        }
+
+        unsigned long long completedCount = 0;
+        unsigned long long corruptedCount = 0;
+        PonkFrameAssembler assembler([&](const PonkFrameAssembler::Frame& completed) {
+            completedCount++;
+            if (completed.size != frame.fullData.size() || memcmp(completed.data, &frame.fullData[0], completed.size) != 0) {
+                corruptedCount++;
+            }
+        });
+
+        unsigned long long chunkTotal = 0;
+        const auto emit = [&](unsigned int frameNumber, size_t firstChunk, size_t lastChunk) {
+            for (size_t i=firstChunk; i<lastChunk; i++) {
+                for (unsigned int sender=0; sender<ASSEMBLER_SENDER_COUNT; sender++) {
+                    GeomUdpHeader* header = reinterpret_cast<GeomUdpHeader*>(&packets[i][0]);
+                    header->senderIdentifier = sender;
+                    header->frameNumber = static_cast<unsigned char>(frameNumber);
+                    GenericAddr source;
+                    source.family = AF_INET;
+                    source.ip = LOOPBACK_IP;
+                    source.port = static_cast<unsigned short>(40000 + sender);
+                    const unsigned int repeat = i == 0 ? 2 : 1;
+                    for (unsigned int r=0; r<repeat; r++) {
+                        assembler.addChunk(source, &packets[i][0], static_cast<unsigned int>(packets[i].size()));
+                        chunkTotal++;
+                    }
+                }
+            }
+        };
+
+        const size_t half = chunkCount / 2;
+        const auto start = std::chrono::steady_clock::now();
+        emit(0, half, chunkCount);
+        for (unsigned int frameNumber=0; frameNumber<ASSEMBLER_FRAME_COUNT; frameNumber++) {
+            if (frameNumber + 1 < ASSEMBLER_FRAME_COUNT) {
+                emit(frameNumber + 1, half, chunkCount);
+            }
+            emit(frameNumber, 0, half);
+        }
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        const auto& stats = assembler.stats();
+        if (completedCount != ASSEMBLER_SENDER_COUNT * ASSEMBLER_FRAME_COUNT || corruptedCount != 0) {
+            failedChecks++;
+        }
+        std::cout << "  " << chunkCount << " chunks: " << completedCount << " / " << ASSEMBLER_SENDER_COUNT * ASSEMBLER_FRAME_COUNT
+                  << " frames complete (" << corruptedCount << " corrupted), " << stats.duplicateChunks << " duplicates detected, "
+                  << stats.framesIncomplete << " given up, " << ns / std::max(1ull, chunkTotal) << " ns/chunk" << std::endl;
+    }
+}
+
+typedef unsigned int (*ChecksumKernel)(const void*, size_t, unsigned int);
+
+// Check that all checksum kernels agree with the scalar one on odd sizes and alignments, then measure them
+static void benchmarkChecksum() {
+    std::vector<std::pair<const char*, ChecksumKernel>> kernels;
+    kernels.push_back(std::make_pair("scalar", &ponkChecksumScalar));
+#ifdef PONK_CHECKSUM_SSE2
+    kernels.push_back(std::make_pair("sse2", &ponkChecksumSse2));
+#endif
+#ifdef PONK_CHECKSUM_AVX2
+#ifdef PONK_CHECKSUM_AVX2_RUNTIME
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back(std::make_pair("avx2", &ponkChecksumAvx2));
+    }
+#else
+    kernels.push_back(std::make_pair("avx2", &ponkChecksumAvx2));
+#endif
+#endif
+    kernels.push_back(std::make_pair("dispatched", &ponkChecksum));
+
+    std::cout << "Checksum benchmark: " << CHECKSUM_BUFFER_BYTES / 1024 << " KB buffer" << std::endl;
+
+    std::vector<unsigned char> buffer(CHECKSUM_BUFFER_BYTES);
+    for (size_t i=0; i<buffer.size(); i++) {
+        buffer[i] = static_cast<unsigned char>((i * 2654435761u) >> 13);
+    }
+
+    for (const auto& kernel: kernels) {
+        bool agree = true;
+        for (size_t offset=0; offset<33; offset++) {
+            for (size_t size=0; size<300; size+=7) {
+                if (kernel.second(&buffer[offset], size, 0x12345678u) != ponkChecksumScalar(&buffer[offset], size, 0x12345678u)) {
+                    agree = false;
+                }
+            }
+        }
+        // Running sum split at odd positions, the way chunks are added
+        unsigned int running = 0;
+        for (size_t offset=0; offset<buffer.size(); offset+=1357) {
+            running = kernel.second(&buffer[offset], (std::min)(size_t(1357), buffer.size() - offset), running);
+        }
+        if (running != ponkChecksumScalar(buffer.data(), buffer.size())) {
+            agree = false;
+        }
+
+        unsigned long long passes = 0;
+        volatile unsigned int sink = 0;
+        const auto start = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::steady_clock::duration::zero();
+        while (elapsed < std::chrono::milliseconds(CHECKSUM_DURATION_MS)) {
+            sink = kernel.second(buffer.data(), buffer.size(), sink);
+            passes++;
+            elapsed = std::chrono::steady_clock::now() - start;
+        }
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        if (!agree) {
+            failedChecks++;
+        }
+        std::cout << "  " << kernel.first << ": " << (agree ? "" : "MISMATCH, ")
+                  << double(passes) * buffer.size() / double(ns) << " GB/s" << std::endl;
+    }
+}
+
+// Frame data with paths alternating both data formats, and the points the parser should decode from it
+struct ParserFrame {
+    std::vector<unsigned char> data;
+    std::vector<float> x, y, r, g, b;
+
+    ParserFrame() {
+        for (unsigned int pathIndex=0; pathIndex<PARSER_PATH_COUNT; pathIndex++) {
+            const unsigned char dataFormat = pathIndex % 2 ? PONK_DATA_FORMAT_XY_F32_RGB_U8 : PONK_DATA_FORMAT_XYRGB_U16;
+            data.push_back(dataFormat);
+            data.push_back(1);
+            const char name[] = "PATHNUMB";
+            const float pathNumber = static_cast<float>(pathIndex);
+            data.insert(data.end(), name, name + 8);
+            push(&pathNumber, sizeof(pathNumber));
+            const unsigned short pointCount = PARSER_POINTS_PER_PATH;
+            push(&pointCount, sizeof(pointCount));
+            for (unsigned int i=0; i<PARSER_POINTS_PER_PATH; i++) {
+                const unsigned int seed = pathIndex * PARSER_POINTS_PER_PATH + i;
+                if (dataFormat == PONK_DATA_FORMAT_XYRGB_U16) {
+                    const unsigned short values[5] = {
+                        static_cast<unsigned short>(seed * 97), static_cast<unsigned short>(seed * 193),
+                        static_cast<unsigned short>(seed * 7), 65535, 0
+                    };
+                    push(values, sizeof(values));
+                    x.push_back((std::min)(1.f, values[0] * (2.f / 65535.f) - 1));
+                    y.push_back((std::min)(1.f, values[1] * (2.f / 65535.f) - 1));
+                    r.push_back((std::min)(1.f, values[2] * (1.f / 65535.f)));
+                    g.push_back((std::min)(1.f, values[3] * (1.f / 65535.f)));
+                    b.push_back((std::min)(1.f, values[4] * (1.f / 65535.f)));
+                } else {
+                    const float position[2] = { (seed % 200) / 100.f - 1, (seed % 150) / 75.f - 1 };
+                    const unsigned char color[3] = { static_cast<unsigned char>(seed), 255, 0 };
+                    push(position, sizeof(position));
+                    push(color, sizeof(color));
+                    x.push_back(position[0]);
+                    y.push_back(position[1]);
+                    r.push_back((std::min)(1.f, color[0] * (1.f / 255.f)));
+                    g.push_back((std::min)(1.f, color[1] * (1.f / 255.f)));
+                    b.push_back((std::min)(1.f, color[2] * (1.f / 255.f)));
+                }
+            }
+        }
+    }
+
+    void push(const void* value, size_t size) {
+        data.insert(data.end(), static_cast<const unsigned char*>(value), static_cast<const unsigned char*>(value) + size);
+    }
+};
+
+struct DecodeKernel {
+    const char* name;
+    unsigned char dataFormat;
+    PonkPointDecoder decoder;
+};
+
+// Check that the SIMD decode kernels give the scalar results to the bit on random bytes (out of range, NaN and
+// infinite floats included) for all tail lengths, then measure them on PARSER_POINTS_PER_PATH points paths
+static void benchmarkDecode() {
+    std::vector<DecodeKernel> kernels;
+    kernels.push_back({ "U16 scalar", PONK_DATA_FORMAT_XYRGB_U16, &ponkDecodeXYRGB_U16Scalar });
+#ifdef PONK_DECODE_SSE41
+    if (ponkDecodeHasSse41()) {
+        kernels.push_back({ "U16 sse4.1", PONK_DATA_FORMAT_XYRGB_U16, &ponkDecodeXYRGB_U16Sse41 });
+    }
+#endif
+#ifdef PONK_DECODE_AVX2
+    if (ponkDecodeHasAvx2()) {
+        kernels.push_back({ "U16 avx2", PONK_DATA_FORMAT_XYRGB_U16, &ponkDecodeXYRGB_U16Avx2 });
+    }
+#endif
+    kernels.push_back({ "F32/U8 scalar", PONK_DATA_FORMAT_XY_F32_RGB_U8, &ponkDecodeXY_F32_RGB_U8Scalar });
+#ifdef PONK_DECODE_SSE2
+    kernels.push_back({ "F32/U8 sse2", PONK_DATA_FORMAT_XY_F32_RGB_U8, &ponkDecodeXY_F32_RGB_U8Sse2 });
+#endif
+#ifdef PONK_DECODE_AVX2
+    if (ponkDecodeHasAvx2()) {
+        kernels.push_back({ "F32/U8 avx2", PONK_DATA_FORMAT_XY_F32_RGB_U8, &ponkDecodeXY_F32_RGB_U8Avx2 });
+    }
+#endif
+
+    const unsigned int maxPoints = PARSER_POINTS_PER_PATH;
+    std::vector<unsigned char> data(maxPoints * 11);
+    unsigned int seed = 12345;
+    for (auto& byte: data) {
+        seed = seed * 1103515245 + 12345;
+        byte = static_cast<unsigned char>(seed >> 16);
+    }
+    // Some F32 positions in range, and a few non finite ones
+    const float specials[] = { 0.5f, -0.25f, 1.f, -1.f, std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+                               std::numeric_limits<float>::quiet_NaN(), 3.f };
+    for (unsigned int i=0; i<maxPoints; i+=3) {
+        memcpy(&data[i * 11 + (i % 2) * 4], &specials[i % 8], sizeof(float));
+    }
+
+    std::vector<std::vector<float>> expected(5, std::vector<float>(maxPoints));
+    std::vector<std::vector<float>> decoded(5, std::vector<float>(maxPoints));
+    const PonkPointArrays expectedArrays = { &expected[0][0], &expected[1][0], &expected[2][0], &expected[3][0], &expected[4][0] };
+    const PonkPointArrays decodedArrays = { &decoded[0][0], &decoded[1][0], &decoded[2][0], &decoded[3][0], &decoded[4][0] };
+
+    std::cout << "Decode benchmark: " << maxPoints << " points paths" << std::endl;
+    for (const auto& kernel: kernels) {
+        const PonkPointDecoder reference = kernel.dataFormat == PONK_DATA_FORMAT_XYRGB_U16 ? &ponkDecodeXYRGB_U16Scalar : &ponkDecodeXY_F32_RGB_U8Scalar;
+        bool agree = true;
+        for (unsigned int count=0; count<=maxPoints && agree; count++) {
+            const unsigned int expectedNonFinite = reference(&data[0], count, expectedArrays);
+            const unsigned int nonFinite = kernel.decoder(&data[0], count, decodedArrays);
+            for (size_t component=0; component<5; component++) {
+                if (count > 0 && memcmp(&expected[component][0], &decoded[component][0], count * sizeof(float)) != 0) {
+                    agree = false;
+                }
+            }
+            if (nonFinite != expectedNonFinite) {
+                agree = false;
+            }
+        }
+
+        unsigned long long decodes = 0;
+        const auto start = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::steady_clock::duration::zero();
+        while (elapsed < std::chrono::milliseconds(PARSER_DURATION_MS)) {
+            for (int repeat=0; repeat<64; repeat++) {
+                kernel.decoder(&data[0], maxPoints, decodedArrays);
+            }
+            decodes += 64;
+            elapsed = std::chrono::steady_clock::now() - start;
+        }
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        if (!agree) {
+            failedChecks++;
+        }
+        std::cout << "  " << kernel.name << ": " << (agree ? "" : "MISMATCH, ") << double(ns) / double(decodes * maxPoints) << " ns/point" << std::endl;
+    }
+}
+
+// Check the decoded paths and points, that a truncated frame keeps its complete paths, then measure
+// steady state parsing, during which the path table and point arrays must not be reallocated
+static void benchmarkParser() {
+    std::cout << "Parser benchmark: " << PARSER_PATH_COUNT << " paths of " << PARSER_POINTS_PER_PATH << " points, both data formats" << std::endl;
+
+    const ParserFrame frame;
+    PonkFrameParser parser;
+    bool valid = parser.parse(frame.data.data(), frame.data.size()) == PonkParseResult::Ok &&
+                 parser.paths().size() == PARSER_PATH_COUNT && parser.pointCount() == frame.x.size();
+    for (size_t i=0; valid && i<frame.x.size(); i++) {
+        valid = parser.x()[i] == frame.x[i] && parser.y()[i] == frame.y[i] &&
+                parser.r()[i] == frame.r[i] && parser.g()[i] == frame.g[i] && parser.b()[i] == frame.b[i];
+    }
+    for (size_t i=0; valid && i<parser.paths().size(); i++) {
+        const PonkPath& path = parser.paths()[i];
+        float pathNumber = 0;
+        memcpy(&pathNumber, path.metaData[0].value, sizeof(pathNumber));
+        valid = path.metaDataCount == 1 && pathNumber == static_cast<float>(i) &&
+                path.firstPoint == i * PARSER_POINTS_PER_PATH && path.pointCount == PARSER_POINTS_PER_PATH;
+    }
+    if (!valid) {
+        std::cout << "  Frame not decoded as sent" << std::endl;
+        failedChecks++;
+    }
+    if (parser.parse(frame.data.data(), frame.data.size() - 1) != PonkParseResult::Truncated || parser.paths().size() != PARSER_PATH_COUNT - 1) {
+        std::cout << "  Truncated frame not detected" << std::endl;
+        failedChecks++;
+    }
+
+    parser.parse(frame.data.data(), frame.data.size());
+    const PonkPath* paths = parser.paths().data();
+    const float* x = parser.x();
+    unsigned long long parses = 0;
+    const auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::steady_clock::duration::zero();
+    while (elapsed < std::chrono::milliseconds(PARSER_DURATION_MS)) {
+        parser.parse(frame.data.data(), frame.data.size());
+        parses++;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    const bool reallocated = parser.paths().data() != paths || parser.x() != x;
+    std::cout << "  " << ns / parses << " ns/frame, " << double(ns) / double(parses * frame.x.size()) << " ns/point"
+              << (reallocated ? ", buffers reallocated in steady state" : ", no reallocation") << std::endl;
+}
+
+// A network thread publishes frames as fast as it can while a consumer takes them at a given pace: every
+// acquired frame must be whole and newer than the previous one, and publishing must never wait for the consumer
+static void benchmarkMailbox() {
+    std::cout << "Mailbox benchmark: " << MAILBOX_FRAME_BYTES / 1024 << " KB frames published back to back, consumer at various paces" << std::endl;
+
+    const int consumerPausesUs[] = { 0, 100, 16666 };
+    for (auto pauseUs: consumerPausesUs) {
+        PonkFrameMailboxes mailboxes(1);
+        std::atomic<bool> stop(false);
+        unsigned long long acquiredCount = 0;
+        unsigned long long tornCount = 0;
+        unsigned long long outOfOrderCount = 0;
+        std::thread consumer([&]() {
+            unsigned long long lastSequence = 0;
+            while (!stop.load()) {
+                const PonkMailboxFrame* frame = mailboxes.senderCount() > 0 ? mailboxes.mailbox(0).acquire() : nullptr;
+                if (frame) {
+                    // Sequence number first, then bytes derived from it
+                    unsigned long long sequence = 0;
+                    memcpy(&sequence, frame->data.data(), sizeof(sequence));
+                    for (size_t i=sizeof(sequence); i<frame->data.size(); i+=61) {
+                        if (frame->data[i] != static_cast<unsigned char>(sequence + i)) {
+                            tornCount++;
+                            break;
+                        }
+                    }
+                    if (sequence <= lastSequence) {
+                        outOfOrderCount++;
+                    }
+                    lastSequence = sequence;
+                    acquiredCount++;
+                }
+                if (pauseUs > 0) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(pauseUs));
+                }
+            }
+        });
+
+        std::vector<unsigned char> data(MAILBOX_FRAME_BYTES);
+        PonkFrameAssembler::Frame frame;
+        frame.sender.ip = LOOPBACK_IP;
+        frame.senderName = "Benchmark";
+        frame.size = data.size();
+        frame.data = data.data();
+        unsigned long long sequence = 0;
+        long long maxPublishNs = 0;
+        long long totalPublishNs = 0;
+        const auto start = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(MAILBOX_DURATION_MS)) {
+            sequence++;
+            memcpy(&data[0], &sequence, sizeof(sequence));
+            for (size_t i=sizeof(sequence); i<data.size(); i+=61) {
+                data[i] = static_cast<unsigned char>(sequence + i);
+            }
+            frame.frameNumber = static_cast<unsigned char>(sequence);
+            const auto publishStart = std::chrono::steady_clock::now();
+            mailboxes.publish(frame);
+            const auto publishNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - publishStart).count();
+            totalPublishNs += publishNs;
+            maxPublishNs = (std::max)(maxPublishNs, static_cast<long long>(publishNs));
+        }
+        stop.store(true);
+        consumer.join();
+
+        const auto stats = mailboxes.mailbox(0).stats();
+        const bool consistent = stats.acquired == acquiredCount && stats.published == sequence &&
+                                stats.published - stats.superseded - stats.acquired <= 1;
+        if (!consistent || tornCount > 0 || outOfOrderCount > 0) {
+            failedChecks++;
+        }
+        std::cout << "  Consumer pause " << pauseUs << " us: " << stats.published << " published, " << stats.acquired << " acquired, "
+                  << stats.superseded << " superseded" << (consistent ? "" : " (COUNTERS MISMATCH)") << ", "
+                  << tornCount << " torn, " << outOfOrderCount << " out of order, publish " << totalPublishNs / (std::max)(1ull, sequence)
+                  << " ns avg, " << maxPublishNs / 1000 << " us max" << std::endl;
+    }
+
+    // Senders restarting from new ports: a full table refuses a new sender while all others are active, then
+    // hands it the mailbox of an idle one, so many more ports than mailboxes get their frames through over time
+    PonkFrameMailboxes mailboxes(MAILBOX_SENDER_COUNT, MAILBOX_SENDER_IDLE_MS);
+    std::vector<unsigned char> data(64);
+    PonkFrameAssembler::Frame frame;
+    frame.sender.ip = LOOPBACK_IP;
+    frame.senderName = "Benchmark";
+    frame.size = data.size();
+    frame.data = data.data();
+    unsigned short port = 40000;
+    bool recycled = true;
+    for (unsigned int round=0; round<MAILBOX_RESTART_ROUNDS; round++) {
+        for (unsigned int i=0; i<MAILBOX_SENDER_COUNT; i++) {
+            frame.sender.port = port++;
+            recycled = mailboxes.publish(frame) && recycled;
+        }
+        // All mailboxes were just published to, until they are idle
+        frame.sender.port = port;
+        recycled = !mailboxes.publish(frame) && recycled;
+        for (unsigned int i=0; i<MAILBOX_SENDER_COUNT; i++) {
+            PonkFrameMailbox& mailbox = mailboxes.mailbox(i);
+            const PonkMailboxFrame* acquired = mailbox.acquire();
+            recycled = acquired && acquired->sender.port >= port - MAILBOX_SENDER_COUNT && mailbox.stats().generation == round &&
+                       mailbox.stats().published == 1 && recycled;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2 * MAILBOX_SENDER_IDLE_MS));
+    }
+    if (!recycled) {
+        failedChecks++;
+    }
+    std::cout << "  " << port - 40000 << " sender ports over time, " << mailboxes.senderCount() << " mailboxes: " << mailboxes.reassignedCount()
+              << " reassigned" << (recycled ? "" : " (RECYCLING MISMATCH)") << std::endl;
+}
+
+static GeomUdpMetaData makeMetaData(PonkMetaDataKey key, float value) {
+    GeomUdpMetaData metaData;
+    for (int i=0; i<8; i++) {
+        metaData.name[i] = static_cast<char>((key >> (8 * i)) & 0xFF);
+    }
+    memcpy(metaData.value, &value, sizeof(value));
+    return metaData;
+}
+
+// Check typed decoding (rounding, range checks, unknown keys), then compare decoding the meta data of a path
+// to building a string for each key as receivers used to
+static void benchmarkMetaData() {
+    std::cout << "Meta data benchmark" << std::endl;
+
+    std::vector<GeomUdpMetaData> metaData;
+    metaData.push_back(makeMetaData(ponkEightCC("PATHNUMB"), 12.6f));
+    metaData.push_back(makeMetaData(ponkEightCC("MAXSPEED"), 2.f));
+    metaData.push_back(makeMetaData(ponkEightCC("SKIPBLCK"), 1.f));
+    metaData.push_back(makeMetaData(ponkEightCC("ANGLETHR"), 120.f));                                   // Clamped to 90
+    metaData.push_back(makeMetaData(ponkEightCC("POLYFADI"), std::numeric_limits<float>::quiet_NaN())); // Ignored
+    metaData.push_back(makeMetaData(ponkMetaDataKey("CUSTOM"), 3.5f));
+    for (int i=0; i<PONK_META_DATA_MAX_UNKNOWN; i++) {
+        metaData.push_back(makeMetaData(ponkMetaDataKey("EXTRA"), static_cast<float>(i)));             // One too many
+    }
+
+    PonkPathMetaData decoded;
+    ponkDecodeMetaData(metaData.data(), static_cast<unsigned int>(metaData.size()), decoded);
+    const unsigned int outOfRange = (1u << static_cast<unsigned int>(PonkMetaDataId::AngleThreshold)) |
+                                    (1u << static_cast<unsigned int>(PonkMetaDataId::PolygonFadeIn));
+    const bool valid = decoded.pathNumber == 13 && decoded.maxSpeed == 2.f && decoded.skipBlack && decoded.angleThreshold == 90.f &&
+                       !decoded.has(PonkMetaDataId::PolygonFadeIn) && decoded.has(PonkMetaDataId::AngleThreshold) &&
+                       !decoded.has(PonkMetaDataId::MinimumPoints) && decoded.outOfRange == outOfRange &&
+                       decoded.unknownCount == PONK_META_DATA_MAX_UNKNOWN && decoded.unknownDropped == 1 &&
+                       decoded.unknown[0].key == ponkMetaDataKey("CUSTOM") && decoded.unknown[0].value == 3.5f;
+    if (!valid) {
+        std::cout << "  Meta data not decoded as expected" << std::endl;
+        failedChecks++;
+    }
+
+    // A path as the samples send it
+    const GeomUdpMetaData pathMetaData[] = { makeMetaData(ponkEightCC("PATHNUMB"), 1.f), makeMetaData(ponkEightCC("MAXSPEED"), 1.f),
+                                             makeMetaData(ponkEightCC("ANGLEOPT"), 1.f), makeMetaData(ponkEightCC("MINIPNTS"), 20.f) };
+    const unsigned int pathMetaDataCount = sizeof(pathMetaData) / sizeof(pathMetaData[0]);
+    for (int strings=0; strings<2; strings++) {
+        unsigned long long paths = 0;
+        volatile float sink = 0;
+        const auto start = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::steady_clock::duration::zero();
+        while (elapsed < std::chrono::milliseconds(METADATA_DURATION_MS)) {
+            for (int repeat=0; repeat<256; repeat++) {
+                if (strings) {
+                    std::map<std::string, float> byName;
+                    for (unsigned int i=0; i<pathMetaDataCount; i++) {
+                        byName[std::string(pathMetaData[i].name, sizeof(pathMetaData[i].name))] = *reinterpret_cast<const float*>(pathMetaData[i].value);
+                    }
+                    sink = byName["MAXSPEED"];
+                } else {
+                    ponkDecodeMetaData(pathMetaData, pathMetaDataCount, decoded);
+                    sink = decoded.maxSpeed;
+                }
+            }
+            paths += 256;
+            elapsed = std::chrono::steady_clock::now() - start;
+        }
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        if (sink != 1.f) {
+            failedChecks++;
+        }
+        std::cout << "  " << (strings ? "String map" : "Typed decode") << ": " << double(ns) / double(paths) << " ns/path ("
+                  << pathMetaDataCount << " keys)" << (sink == 1.f ? "" : ", MAXSPEED not read back") << std::endl;
+    }
+}
+
+// Check histogram buckets and percentiles, then that the assembler counts losses of a scripted sender under
+// the right causes, then measure what counting costs per chunk
+static void benchmarkStats() {
+    std::cout << "Receiver stats benchmark" << std::endl;
+
+    bool bucketsValid = true;
+    for (unsigned int i=0; i<PonkLatencyHistogram::BucketCount; i++) {
+        const unsigned long long upperBound = PonkLatencyHistogram::bucketUpperBound(i);
+        if (PonkLatencyHistogram::bucketIndex(upperBound) != i || (i > 0 && PonkLatencyHistogram::bucketIndex(upperBound + 1) != (std::min)(i + 1, PonkLatencyHistogram::BucketCount - 1u))) {
+            bucketsValid = false;
+        }
+    }
+    PonkLatencyHistogram histogram;
+    for (unsigned long long value=1; value<=100000; value++) {
+        histogram.record(value * 10);
+    }
+    PonkHistogramSnapshot snapshot;
+    histogram.snapshot(snapshot);
+    const double fractions[] = { 0.5, 0.9, 0.99, 0.999, 1.0 };
+    for (auto fraction: fractions) {
+        const double exact = fraction * 1000000;
+        const double reported = static_cast<double>(snapshot.percentile(fraction));
+        if (reported < exact || reported > exact * (1 + 1.0 / PonkLatencyHistogram::SubBucketCount)) {
+            bucketsValid = false;
+        }
+    }
+    if (!bucketsValid || snapshot.count() != 100000) {
+        std::cout << "  Histogram buckets or percentiles not within 1/" << PonkLatencyHistogram::SubBucketCount << std::endl;
+        failedChecks++;
+    }
+
+    // One chunk lost in frame 10, frame 20 not sent, a chunk of frame 30 sent twice, a byte of frame 40 corrupted,
+    // a chunk from a newer protocol version and a datagram that isn't PONK. Chunks arrive 1 us apart
+    BenchmarkFrame frame(4);
+    std::vector<std::vector<unsigned char>> packets;
+    for (size_t i=0; i<4; i++) {
+        packets.push_back(frame.packet(i));
+    }
+    PonkReceiverStats receiverStats;
+    PonkFrameAssembler assembler(nullptr, 16, &receiverStats);
+    GenericAddr source;
+    source.ip = LOOPBACK_IP;
+    source.port = 40000;
+    unsigned long long timestampNs = 1000000;
+    for (unsigned int frameNumber=0; frameNumber<STATS_FRAME_COUNT; frameNumber++) {
+        if (frameNumber == 20) {
+            continue;
+        }
+        for (size_t i=0; i<packets.size(); i++) {
+            std::vector<unsigned char> packet = packets[i];
+            reinterpret_cast<GeomUdpHeader*>(&packet[0])->frameNumber = static_cast<unsigned char>(frameNumber);
+            if (frameNumber == 40 && i == 1) {
+                packet[sizeof(GeomUdpHeader)]++;
+            }
+            const unsigned int repeat = frameNumber == 30 && i == 0 ? 2 : (frameNumber == 10 && i == 2 ? 0 : 1);
+            for (unsigned int r=0; r<repeat; r++) {
+                timestampNs += 1000;
+                assembler.addChunk(source, &packet[0], static_cast<unsigned int>(packet.size()), timestampNs);
+            }
+        }
+    }
+    std::vector<unsigned char> newerVersion = packets[0];
+    reinterpret_cast<GeomUdpHeader*>(&newerVersion[0])->protocolVersion = PONK_PROTOCOL_VERSION + 1;
+    reinterpret_cast<GeomUdpHeader*>(&newerVersion[0])->senderIdentifier = 2;
+    const bool newerRejected = assembler.addChunk(source, &newerVersion[0], static_cast<unsigned int>(newerVersion.size())) == PonkChunkResult::UnsupportedVersion;
+    const char notPonk[] = "GET / HTTP/1.1 and then some more bytes to fill a header";
+    assembler.addChunk(source, notPonk, sizeof(notPonk));
+    // Decoding is counted by the thread parsing frames, which finds the stats the assembler created
+    PonkSenderKey key;
+    key.ip = source.ip;
+    key.port = source.port;
+    key.senderIdentifier = frame.headers[0].senderIdentifier;
+    if (PonkSenderStats* senderStats = receiverStats.find(key)) {
+        senderStats->recordDecode(5000);
+        senderStats->countUnsupportedFormat();
+    }
+
+    const PonkReceiverStatsSnapshot stats = receiverStats.snapshot();
+    const PonkSenderStatsSnapshot* sender = stats.senders.size() == 2 ? &stats.senders[0] : nullptr;
+    const bool attributed = sender && newerRejected && stats.invalidDatagrams == 1 && stats.senders[1].unsupportedVersion == 1 &&
+                            sender->framesCompleted == STATS_FRAME_COUNT - 3 && sender->crcFailures == 1 &&
+                            sender->framesLost == 2 && sender->chunksLost == 1 && sender->chunksDuplicated == 1 &&
+                            sender->chunksReceived == (STATS_FRAME_COUNT - 1) * 4 && sender->unsupportedVersion == 0 &&
+                            sender->framesDecoded == 1 && sender->unsupportedFormat == 1 &&
+                            sender->chunkInterArrival.count() == sender->chunksReceived - 1 &&
+                            sender->chunkInterArrival.percentile(0.5) == PonkLatencyHistogram::bucketUpperBound(PonkLatencyHistogram::bucketIndex(1000)) &&
+                            sender->reassembly.count() == STATS_FRAME_COUNT - 3 &&
+                            sender->reassembly.percentile(0.5) == PonkLatencyHistogram::bucketUpperBound(PonkLatencyHistogram::bucketIndex(3000)) &&
+                            sender->reassembly.max() == PonkLatencyHistogram::bucketUpperBound(PonkLatencyHistogram::bucketIndex(4000));
+    if (!attributed) {
+        std::cout << "  Losses not counted under the right causes: " << ponkReceiverStatsJson(stats) << std::endl;
+        failedChecks++;
+    }
+
+    // A sender restarted from another port keeps its stats, a new sender past maxSenders is refused and counted
+    PonkReceiverStats fullStats(2);
+    PonkSenderKey restarted = key;
+    restarted.port++;
+    PonkSenderKey other = key;
+    other.senderIdentifier++;
+    PonkSenderKey refused = key;
+    refused.ip++;
+    PonkSenderStats* first = fullStats.sender(key, "First");
+    const bool registryValid = first && fullStats.sender(restarted, "First") == first && fullStats.find(restarted) == first &&
+                               fullStats.sender(other, "Other") && !fullStats.sender(refused, "Refused") && !fullStats.find(refused) &&
+                               fullStats.snapshot().senders.size() == 2 && fullStats.snapshot().senderRejections == 1;
+    if (!registryValid) {
+        std::cout << "  Restarted or refused senders not handled: " << ponkReceiverStatsJson(fullStats.snapshot()) << std::endl;
+        failedChecks++;
+    }
+
+    // Same 8 chunk frames with and without stats, with timestamps
+    const BenchmarkFrame timedFrame(8);
+    packets.clear();
+    for (size_t i=0; i<8; i++) {
+        packets.push_back(timedFrame.packet(i));
+    }
+    for (int withStats=0; withStats<2; withStats++) {
+        PonkReceiverStats timedStats;
+        PonkFrameAssembler timedAssembler(nullptr, 16, withStats ? &timedStats : nullptr);
+        unsigned long long chunkTotal = 0;
+        unsigned int frameNumber = 0;
+        const auto start = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::steady_clock::duration::zero();
+        while (elapsed < std::chrono::milliseconds(STATS_DURATION_MS)) {
+            for (auto& packet: packets) {
+                reinterpret_cast<GeomUdpHeader*>(&packet[0])->frameNumber = static_cast<unsigned char>(frameNumber);
+                timedAssembler.addChunk(source, &packet[0], static_cast<unsigned int>(packet.size()), ++timestampNs);
+            }
+            frameNumber++;
+            chunkTotal += packets.size();
+            elapsed = std::chrono::steady_clock::now() - start;
+        }
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        std::cout << "  Assembler " << (withStats ? "with" : "without") << " stats: " << double(ns) / double(chunkTotal) << " ns/chunk" << std::endl;
+    }
+    std::cout << "  " << ponkReceiverStatsJson(stats) << std::endl;
+}
+
+enum class RecvMode {
+    RecvFrom,
+    RecvBatch,
+    IoUring
+};
+
+static const char* recvModeName(RecvMode mode) {
+    switch (mode) {
+        case RecvMode::RecvFrom: return "recvFrom";
+        case RecvMode::RecvBatch: return "recvBatch (recvmmsg)";
+        case RecvMode::IoUring: return "io_uring";
+    }
+    return "";
+}
+
+// Receive on the calling thread while senderCount threads send 8 chunks frames, returns received datagrams
+static unsigned long long receiveWithSenders(RecvMode mode, unsigned int senderCount, unsigned long long& sentCount) {
+    DatagramSocketOptions options;
+    options.receiveBufferSize = 8 * 1024 * 1024;
+    if (mode == RecvMode::IoUring) {
+        options.receiveBackend = DatagramReceiveBackend::IoUring;
+    }
+    DatagramSocket socket(LOOPBACK_IP, BENCHMARK_RECV_PORT, options);
+
+    std::atomic<bool> sending{true};
+    std::atomic<unsigned long long> sent{0};
+    std::vector<std::thread> senders;
+    for (unsigned int i=0; i<senderCount; i++) {
+        senders.push_back(std::thread([&sending, &sent]() {
+            GenericAddr destAddr;
+            destAddr.family = AF_INET;
+            destAddr.ip = LOOPBACK_IP;
+            destAddr.port = BENCHMARK_RECV_PORT;
+            DatagramSocket senderSocket(INADDR_ANY, 0);
+            const BenchmarkFrame frame(8);
+            while (sending) {
+                if (senderSocket.sendBatch(destAddr, &frame.chunks[0], static_cast<unsigned int>(frame.chunks.size()))) {
+                    sent += frame.chunks.size();
+                }
+            }
+        }));
+    }
+
+    std::vector<std::vector<unsigned char>> ringStorage(BENCHMARK_RECV_BATCH_SIZE, std::vector<unsigned char>(65536));
+    std::vector<DatagramBuffer> ring(BENCHMARK_RECV_BATCH_SIZE);
+    for (int i=0; i<BENCHMARK_RECV_BATCH_SIZE; i++) {
+        ring[i].buf = &ringStorage[i][0];
+        ring[i].capacity = static_cast<unsigned int>(ringStorage[i].size());
+    }
+
+    unsigned long long receivedCount = 0;
+    const auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(BENCHMARK_DURATION_MS);
+    while (std::chrono::steady_clock::now() < end) {
+        unsigned int count = 0;
+        if (mode == RecvMode::RecvFrom) {
+            GenericAddr from;
+            unsigned int size = ring[0].capacity;
+            socket.recvFrom(from, ring[0].buf, size);
+            count = size > 0 ? 1 : 0;
+        } else {
+            socket.recvBatch(&ring[0], BENCHMARK_RECV_BATCH_SIZE, count);
+        }
+        if (count == 0) {
+            socket.waitReadable(10000);
+        }
+        receivedCount += count;
+    }
+
+    sending = false;
+    for (auto& sender: senders) {
+        sender.join();
+    }
+    sentCount = sent;
+    return receivedCount;
+}
+
+static void benchmarkReceive() {
+    std::cout << "Receive benchmark: datagrams/sec on loopback, 1, 8 and 32 concurrent senders" << std::endl;
+
+    const RecvMode modes[] = { RecvMode::RecvFrom, RecvMode::RecvBatch, RecvMode::IoUring };
+    const unsigned int senderCounts[] = { 1, 8, 32 };
+    for (auto senderCount: senderCounts) {
+        for (auto mode: modes) {
+            unsigned long long sentCount = 0;
+            const auto receivedCount = receiveWithSenders(mode, senderCount, sentCount);
+            const double seconds = BENCHMARK_DURATION_MS / 1000.0;
+            std::cout << "  " << senderCount << " senders, " << recvModeName(mode) << ": "
+                      << static_cast<unsigned long long>(receivedCount / seconds) << " datagrams/s, "
+                      << receivedCount << " / " << sentCount << " datagrams received" << std::endl;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const std::string benchmark = argc > 1 ? argv[1] : "all";
+    unsigned int zeroCopyDestinationIp = LOOPBACK_IP;
+    const bool validDestination = argc < 3 || (benchmark == "zerocopy" && ipStrToInt(argv[2], zeroCopyDestinationIp));
+    if (argc > 3 || !validDestination || (benchmark != "all" && benchmark != "send" && benchmark != "recv" && benchmark != "zerocopy" && benchmark != "pacing" && benchmark != "assembler" && benchmark != "checksum" && benchmark != "parser" && benchmark != "decode" && benchmark != "mailbox" && benchmark != "metadata" && benchmark != "stats")) {
+        std::cout << "Usage: " << argv[0] << " [all|send|recv|zerocopy|pacing|assembler|checksum|parser|decode|mailbox|metadata|stats]"
+                  << " | zerocopy <ip>" << std::endl;
+        return -1;
+    }
+
+    if (benchmark == "all" || benchmark == "send") {
+        benchmarkSend();
+    }
+    if (benchmark == "all" || benchmark == "zerocopy") {
+        benchmarkZeroCopy(zeroCopyDestinationIp);
+    }
+    if (benchmark == "all" || benchmark == "recv") {
+        benchmarkReceive();
+    }
+    if (benchmark == "all" || benchmark == "pacing") {
+        benchmarkPacing();
+    }
+    if (benchmark == "all" || benchmark == "assembler") {
+        benchmarkAssembler();
+    }
+    if (benchmark == "all" || benchmark == "checksum") {
+        benchmarkChecksum();
+    }
+    if (benchmark == "all" || benchmark == "parser") {
+        benchmarkParser();
+    }
+    if (benchmark == "all" || benchmark == "decode") {
+        benchmarkDecode();
+    }
+    if (benchmark == "all" || benchmark == "mailbox") {
+        benchmarkMailbox();
+    }
+    if (benchmark == "all" || benchmark == "metadata") {
+        benchmarkMetaData();
+    }
+    if (benchmark == "all" || benchmark == "stats") {
+        benchmarkStats();
+    }
+
+    if (failedChecks > 0) {
+        std::cout << failedChecks << " correctness checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
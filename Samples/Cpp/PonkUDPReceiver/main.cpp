@@ -2,290 +2,457 @@
 #include <thread>
 #include <vector>
 #include <cmath>
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
 #include "DatagramSocket/DatagramSocket.h"
+#include "PonkFrameAssembler/PonkFrameAssembler.h"
+#include "PonkFrameMailbox/PonkFrameMailbox.h"
+#include "PonkFrameParser/PonkFrameParser.h"
+#include "PonkMetaData/PonkMetaData.h"
+#include "PonkReceiverStats/PonkReceiverStats.h"
 #include "PonkDefs.h"
 
-int main()
-{
-    std::cout << "Starting" << std::endl;
-
-    DatagramSocket socket(INADDR_ANY,PONK_PORT);
-
-    // TODO: let user choose a network interface or join for all active networkinterfaces
-    // Zero means first active network adapter if I'm not wrong
-    const int networkInterfaceIp = 0; //((192<<24) + (168<<16) + (1<<8) + 3);
+// How the receive loop waits when the socket is empty
+enum class WaitMode {
+    Blocking,   // Park in the kernel until data arrives, no CPU used while idle
+    Hybrid,     // Spin for spinBudgetMicroseconds after the last datagram, then park
+    Spin        // Never park, one core is kept busy polling the socket
+};
+
+// Kernel arrival to user space pickup delay of the first datagram of each wake, printed every second
+class WakeLatencyStats {
+public:
+    void add(unsigned long long timestampNs) {
+        if (timestampNs == 0) {
+            return; // Needs kernel timestamps
+        }
+        const auto now = std::chrono::system_clock::now();
+        const auto nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+        m_samplesNs.push_back(static_cast<long long>(nowNs) - static_cast<long long>(timestampNs));
+        if (now - m_lastReport >= std::chrono::seconds(1)) {
+            report();
+            m_lastReport = now;
+        }
+    }
 
-    int currentFrameNumber = -1;
+private:
+    void report() {
+        std::sort(m_samplesNs.begin(), m_samplesNs.end());
+        const auto percentile = [this](size_t p) { return m_samplesNs[(m_samplesNs.size() - 1) * p / 100] / 1000; };
+        std::cout << "Wake latency over " << std::to_string(m_samplesNs.size()) << " wakes: p50 " << std::to_string(percentile(50))
+                  << " us, p99 " << std::to_string(percentile(99)) << " us, max " << std::to_string(m_samplesNs.back() / 1000) << " us" << std::endl;
+        m_samplesNs.clear();
+    }
 
-    // We'll keep all chunks data in a vector until we get all chunks
-    // Protocol supports up to 255 chunks
-    // We'll accept received data chunks in the wrong order though I doubt it should happen
-    int currentFrameChunkCount = -1;
-    int currentFrameDataCrc = -1;
-    std::vector<bool> chunksDataHasBeenReceived;
-    std::vector<std::vector<unsigned char>> chunksData;
-    chunksDataHasBeenReceived.resize(255);
-    chunksData.resize(255);
+    std::vector<long long> m_samplesNs;
+    std::chrono::system_clock::time_point m_lastReport = std::chrono::system_clock::now();
+};
 
-    while (true) {
-        unsigned char buffer[65536];
-        unsigned int bufferSize = static_cast<unsigned int>(sizeof(buffer));
+// Parse and print a frame taken from a mailbox, decode stats go to senderStats when not null
+static void renderFrame(PonkFrameParser& parser, const PonkMailboxFrame& frame, PonkSenderStats* senderStats)
+{
+    // Seems we're all good, we know have complete frame data
+    std::cout << "Received frame " << std::to_string(frame.frameNumber) << " from " << frame.senderName
+              << " (" << ipIntToStr(frame.sender.ip) << ")" << std::endl;
+
+    // First to last chunk arrival in the kernel, then last chunk arrival to pickup by the render thread
+    if (frame.lastChunkTimestampNs != 0) {
+        const auto nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        std::cout << "  Reassembly time " << std::to_string((frame.lastChunkTimestampNs - frame.firstChunkTimestampNs) / 1000)
+                  << " us, socket to pickup " << std::to_string((static_cast<long long>(nowNs) - static_cast<long long>(frame.lastChunkTimestampNs)) / 1000) << " us" << std::endl;
+    }
 
-        GenericAddr sourceAddr;
-        if (!socket.recvFrom(sourceAddr, buffer, bufferSize)) {
-            assert(false); // Should never happen
-            return -1;
+    // Parse Frame Data: one pass, points decoded to the parser arrays, no allocation once they are big enough
+    const auto parseStart = std::chrono::steady_clock::now();
+    const auto result = parser.parse(frame.data.data(), frame.data.size());
+    if (senderStats) {
+        senderStats->recordDecode(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - parseStart).count());
+        if (result == PonkParseResult::UnknownDataFormat) {
+            senderStats->countUnsupportedFormat();
         }
-
-        if (bufferSize == 0) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            continue;
+    }
+    for (size_t pathIndex=0; pathIndex<parser.paths().size(); pathIndex++) {
+        const PonkPath& path = parser.paths()[pathIndex];
+        // Documented keys are decoded to their type and checked against their range, others are kept as floats
+        PonkPathMetaData metaData;
+        ponkDecodeMetaData(path.metaData, path.metaDataCount, metaData);
+        char name[9];
+        for (unsigned int id=0; id<static_cast<unsigned int>(PonkMetaDataId::Count); id++) {
+            if (metaData.has(static_cast<PonkMetaDataId>(id))) {
+                ponkMetaDataName(PonkMetaDataDefinitions[id].key, name);
+                std::cout << "Path Meta " << name << " = " << ponkMetaDataValue(metaData, static_cast<PonkMetaDataId>(id)) << std::endl;
+            }
         }
-
-        //std::cout << "Received packet of " << std::to_string(bufferSize) << " bytes" << std::endl;
-
-        // Parse buffer
-        if (bufferSize < sizeof(GeomUdpHeader)) {
-            std::cout << "Error in frame, frame size " << std::to_string(bufferSize) << " is lower than header size" << std::endl;
-            continue;
+        for (unsigned int idx=0; idx<metaData.unknownCount; idx++) {
+            ponkMetaDataName(metaData.unknown[idx].key, name);
+            std::cout << "Path Meta " << name << " = " << metaData.unknown[idx].value << " (unknown key)" << std::endl;
         }
-
-        const GeomUdpHeader* header = reinterpret_cast<const GeomUdpHeader*>(buffer);
-
-        // Check protocol header string
-        if (strncmp(header->headerString,PONK_HEADER_STRING,8) != 0) {
-            std::cout << "Error in frame, invalid header" << std::endl;
-            continue;
+        if (metaData.outOfRange != 0) {
+            std::cout << "Warning: meta data out of range in path " << std::to_string(pathIndex) << ", clamped or ignored" << std::endl;
         }
-
-        // Check protocol version
-        if (header->protocolVersion > 0) {
-            std::cout << "Source protocol version is " << std::to_string(header->protocolVersion)
-                      << " but this sample code only support protocol version 0" << std::endl;
-            continue;
+        std::cout << "  -> Path " << std::to_string(pathIndex) << " / Point Count = " << std::to_string(path.pointCount) << std::endl;
+        if (path.nonFiniteValues > 0) {
+            std::cout << "Warning: " << std::to_string(path.nonFiniteValues) << " NaN or infinite coordinates in path " << std::to_string(pathIndex) << std::endl;
         }
+    }
+    if (result == PonkParseResult::Empty) {
+        std::cout << "Error: frame data is empty" << std::endl;
+    } else if (result == PonkParseResult::Truncated) {
+        std::cout << "Error: not enough data to read path " << std::to_string(parser.paths().size()) << std::endl;
+    } else if (result == PonkParseResult::UnknownDataFormat) {
+        std::cout << "Error: unhandled data format in path " << std::to_string(parser.paths().size()) << std::endl;
+    }
+}
 
-        // Read Sender Name string (32 bytes null terminated UTF8 string)
-        //std::cout << "Sender name " << senderName << std::endl;
+// Stands for the laser output thread: takes the newest frame of each sender at its own pace, forever.
+// Network threads never wait for it, frames it is too slow to take are superseded by newer ones.
+// Receiver stats are written to statsOutput as a JSON line every second, when given
+static void renderLoop(const std::vector<std::unique_ptr<PonkFrameMailboxes>>& allMailboxes, int renderFps,
+                       PonkReceiverStats& receiverStats, std::ostream* statsOutput)
+{
+    PonkFrameParser parser;
+    PonkReceiverStatsSnapshot previousStats = receiverStats.snapshot();
+    // Superseded frames already reported, per mailbox: they start over when the mailbox changes sender
+    struct ReportedSuperseded {
+        unsigned int generation = 0;
+        unsigned long long superseded = 0;
+    };
+    std::vector<std::vector<ReportedSuperseded>> reportedSuperseded(allMailboxes.size());
+    // Stats of the sender of each mailbox, looked up again only when it changes: the lookup takes the registry lock
+    struct CachedSenderStats {
+        bool resolved = false;
+        PonkSenderKey sender;
+        PonkSenderStats* stats = nullptr;
+    };
+    std::vector<std::vector<CachedSenderStats>> senderStats(allMailboxes.size());
+    auto lastReport = std::chrono::steady_clock::now();
+    auto nextRender = std::chrono::steady_clock::now();
+    while (true) {
+        for (size_t m=0; m<allMailboxes.size(); m++) {
+            const unsigned int senderCount = allMailboxes[m]->senderCount();
+            senderStats[m].resize(senderCount);
+            for (unsigned int i=0; i<senderCount; i++) {
+                if (const PonkMailboxFrame* frame = allMailboxes[m]->mailbox(i).acquire()) {
+                    // Stats of a sender were created by the network thread with its first chunk, or never will be
+                    // when the registry is full: either way the answer doesn't change until the sender does
+                    CachedSenderStats& cached = senderStats[m][i];
+                    if (!cached.resolved || !(cached.sender == frame->sender)) {
+                        cached.stats = receiverStats.find(frame->sender);
+                        cached.sender = frame->sender;
+                        cached.resolved = true;
+                    }
+                    renderFrame(parser, *frame, cached.stats);
+                }
+            }
+        }
 
-        // Read Frame Number
-        // If we actually received part of a frame, we shouldn't received a different frame number
-        if (currentFrameNumber != -1 && header->frameNumber != currentFrameNumber) {
-            std::cout << "Error: frame number has changed to " << std::to_string(header->frameNumber)
-                      << " but we haved received all chunks from frame number " << std::to_string(currentFrameNumber)
-                      << ". Resetting chunks data" << std::endl;
-            assert(false);
-            // Reset state. Note that ideally we shouldn't skip all chunks from a frame if we receive the first chunk
-            // of next frame before last chunk of previous frame, but keep the sample code simple (we should keep received chunks
-            // for the 256 possible frame number) - a frame will generally fit a single chunk / UDP packet and this case should rarely happen
-            for (auto& chunkData: chunksData) {
-                chunkData.clear();
+        // Frames skipped since the last report, per sender
+        if (std::chrono::steady_clock::now() - lastReport >= std::chrono::seconds(1)) {
+            lastReport = std::chrono::steady_clock::now();
+            for (size_t m=0; m<allMailboxes.size(); m++) {
+                const unsigned int senderCount = allMailboxes[m]->senderCount();
+                reportedSuperseded[m].resize(senderCount);
+                for (unsigned int i=0; i<senderCount; i++) {
+                    const auto stats = allMailboxes[m]->mailbox(i).stats();
+                    ReportedSuperseded& reported = reportedSuperseded[m][i];
+                    if (stats.generation != reported.generation || stats.superseded < reported.superseded) {
+                        reported.generation = stats.generation;
+                        reported.superseded = 0;
+                    }
+                    if (stats.superseded != reported.superseded) {
+                        std::cout << "Warning: " << std::to_string(stats.superseded - reported.superseded) << " frames from "
+                                  << ipIntToStr(allMailboxes[m]->mailbox(i).sender().ip) << " superseded before being rendered ("
+                                  << std::to_string(stats.superseded) << " of " << std::to_string(stats.published) << ")" << std::endl;
+                        reported.superseded = stats.superseded;
+                    }
+                }
             }
-            for (int i=0; i<255; i++) {
-                chunksDataHasBeenReceived[i] = false;
+            if (statsOutput) {
+                PonkReceiverStatsSnapshot stats = receiverStats.snapshot();
+                *statsOutput << ponkReceiverStatsJson(stats, &previousStats) << std::endl;
+                previousStats = std::move(stats);
             }
-            currentFrameNumber = -1;
         }
 
-        // If we're actually reading a frame, ensure chunkCount doesn't change accross same frame headers (buggy sender)
-        if (currentFrameNumber != -1 && currentFrameChunkCount != header->chunkCount) {
-            std::cout << "Error: received a new chunk for a frame with a different chunk count" << std::endl;
-            assert(false);
+        if (renderFps > 0) {
+            nextRender += std::chrono::microseconds(1000000 / renderFps);
+            std::this_thread::sleep_until(nextRender);
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
+    }
+}
 
-        // If we're actually reading a frame, ensure dataCrc doesn't change (buggy sender)
-        if (currentFrameNumber != -1 && currentFrameDataCrc != header->dataCrc) {
-            std::cout << "Error: received a new chunk for a frame with a different data CRC" << std::endl;
-            assert(false);
+// Receive and reassemble frames from a socket, forever. Complete frames are handed to the render thread
+static void receiveLoop(DatagramSocket& socket, PonkFrameMailboxes& mailboxes, PonkReceiverStats& receiverStats, WaitMode waitMode, int spinBudgetMicroseconds)
+{
+    // Frames refused by the mailboxes are reported at most once per second: console writes would slow down this thread
+    unsigned long long refusedFrames = 0;
+    auto lastRefusalReport = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+    auto handleFrame = [&](const PonkFrameAssembler::Frame& frame) {
+        if (!mailboxes.publish(frame)) {
+            receiverStats.countSenderRejection();
+            refusedFrames++;
+            if (std::chrono::steady_clock::now() - lastRefusalReport >= std::chrono::seconds(1)) {
+                lastRefusalReport = std::chrono::steady_clock::now();
+                std::cout << "Warning: too many active senders, " << std::to_string(refusedFrames) << " frames ignored, last one from "
+                          << frame.senderName << " (" << ipIntToStr(frame.sender.ip) << ")" << std::endl;
+                refusedFrames = 0;
+            }
         }
+    };
+
+    // Chunks are grouped by sender and frame, frames of several senders can be assembled at once.
+    // What happens to chunks and frames is counted per sender in the stats shared by all threads
+    PonkFrameAssembler assembler(handleFrame, 16, &receiverStats);
+
+    // Caller-owned ring of receive buffers: all pending datagrams are drained
+    // in a single call instead of one syscall per chunk
+    #define RECV_BATCH_SIZE 64
+    std::vector<std::vector<unsigned char>> ringStorage(RECV_BATCH_SIZE, std::vector<unsigned char>(65536));
+    std::vector<DatagramBuffer> ring(RECV_BATCH_SIZE);
+    for (int i=0; i<RECV_BATCH_SIZE; i++) {
+        ring[i].buf = &ringStorage[i][0];
+        ring[i].capacity = static_cast<unsigned int>(ringStorage[i].size());
+    }
 
-        currentFrameNumber = header->frameNumber;
-        currentFrameChunkCount = header->chunkCount;
-        currentFrameDataCrc = header->dataCrc;
-
-        // Check Chunk Count
-        if (header->chunkCount == 0) {
-            std::cout << "Error in frame, chunk count is zero" << std::endl;
-            assert(false);
+    unsigned int kernelDrops = 0;
+    WakeLatencyStats wakeLatency;
+    bool waking = true;
+    auto spinDeadline = std::chrono::steady_clock::now();
+    while (true) {
+        unsigned int receivedCount = 0;
+        if (!socket.recvBatch(&ring[0], RECV_BATCH_SIZE, receivedCount)) {
+            assert(false); // Should never happen
+            return;
         }
 
-        // Check Chunk number
-        if (header->chunkNumber >= header->chunkCount) {
-            // Sender is buggy
-            std::cout << "Error in frame, chunk number (" << std::to_string(header->chunkNumber) << ") is over chunk count (" << std::to_string(header->chunkCount) << ")" << std::endl;
-            assert(false);
+        if (receivedCount == 0) {
+            waking = true;
+            if (waitMode == WaitMode::Spin ||
+                (waitMode == WaitMode::Hybrid && std::chrono::steady_clock::now() < spinDeadline)) {
+                // Poll again right away: no wakeup delay, at the cost of a busy core
+                continue;
+            }
+            // Park until the socket gets data, no polling delay is added to incoming frames
+            socket.waitReadable(100000);
             continue;
         }
-        if (!chunksData[header->chunkNumber].empty()) {
-            // Buggy sender or dying network
-            std::cout << "Error in frame, we already received data for chunk " << std::to_string(header->chunkNumber) << std::endl;
-            assert(false);
-        }
 
-        // Now read data
-        const auto dataLength = bufferSize - sizeof(GeomUdpHeader);
-        unsigned int bufferOffset = sizeof(GeomUdpHeader);
-        for (unsigned int i=0; i<dataLength; i++) {
-            chunksData[header->chunkNumber].push_back(buffer[bufferOffset++]);
+        // Frames come in bursts of chunks, keep spinning a while after each burst
+        if (waitMode == WaitMode::Hybrid) {
+            spinDeadline = std::chrono::steady_clock::now() + std::chrono::microseconds(spinBudgetMicroseconds);
         }
-        chunksDataHasBeenReceived[header->chunkNumber] = true;
-
-        //std::cout << "Received chunk " << std::to_string(chunkNumber) << "/" << std::to_string(chunkCount) << " for frame " << std::to_string(frameNumber) << std::endl;
-
-        // If we received all frame chunks, log the frame
-        bool receivedAllChunksYet = true;
-        for (int i=0; i<header->chunkCount; i++) {
-            if (!chunksDataHasBeenReceived[i]) {
-                receivedAllChunksYet = false;
-                break;
-            }
+        if (waking) {
+            wakeLatency.add(ring[0].timestampNs);
+            waking = false;
         }
 
-        if (receivedAllChunksYet) {
-            // Put all frame data together in a single buffer
-            std::vector<unsigned char> allData;
-            allData.reserve(255*PONK_MAX_DATA_BYTES_PER_PACKET);
-            for (int i=0; i<header->chunkCount; i++) {
-                allData.insert(allData.end(),chunksData[i].begin(),chunksData[i].end());
-            }
-
-            // Seems we're all good, we know have complete frame data
-            std::cout << "Received frame " << std::to_string(currentFrameNumber) << std::endl;
-
-            // Reset state
-            for (int i=0; i<header->chunkCount; i++) {
-                chunksData[i].clear();
-                chunksDataHasBeenReceived[i] = false;
-            }
-            currentFrameNumber = -1;
+        // Drops in the socket queue mean we're too slow or the receive buffer too small, not a network issue
+        if (socket.kernelDropCount() != kernelDrops) {
+            std::cout << "Warning: socket receive queue overflowed, " << std::to_string(socket.kernelDropCount() - kernelDrops)
+                      << " datagrams dropped by the kernel (" << std::to_string(socket.kernelDropCount()) << " total)" << std::endl;
+            receiverStats.addKernelDrops(socket.kernelDropCount() - kernelDrops);
+            kernelDrops = socket.kernelDropCount();
+        }
 
-            // Parse Frame Data
-            const auto dataSize = allData.size();
-            if (dataSize < 1) {
-                std::cout << "Error: frame data is empty";
-                assert(false);
-                continue;
+        for (unsigned int i=0; i<receivedCount; i++) {
+            // Coalesced datagrams are split back in PONK chunks in place
+            const auto data = static_cast<const unsigned char*>(ring[i].buf);
+            const unsigned int stride = ring[i].segmentSize > 0 ? ring[i].segmentSize : ring[i].size;
+            for (unsigned int offset=0; offset<ring[i].size; offset+=stride) {
+                const auto result = assembler.addChunk(ring[i].addr, data + offset, std::min(stride, ring[i].size - offset), ring[i].timestampNs);
+                if (result == PonkChunkResult::Invalid) {
+                    std::cout << "Error: invalid chunk from " << ipIntToStr(ring[i].addr.ip) << " (not PONK or bad chunk numbering)" << std::endl;
+                } else if (result == PonkChunkResult::TooManySenders) {
+                    std::cout << "Warning: chunk from new sender " << ipIntToStr(ring[i].addr.ip) << " ignored, too many active senders" << std::endl;
+                } else if (result == PonkChunkResult::UnsupportedVersion) {
+                    std::cout << "Error: chunk from " << ipIntToStr(ring[i].addr.ip) << " uses a newer protocol version, this receiver is not compatible" << std::endl;
+                } else if (result == PonkChunkResult::Duplicate) {
+                    // Buggy sender or dying network
+                    std::cout << "Warning: duplicate chunk from " << ipIntToStr(ring[i].addr.ip) << std::endl;
+                } else if (result == PonkChunkResult::CrcMismatch) {
+                    std::cout << "Error: invalid data CRC from " << ipIntToStr(ring[i].addr.ip) << ", ignoring frame" << std::endl;
+                } else if (result == PonkChunkResult::Late) {
+                    std::cout << "Warning: late chunk from " << ipIntToStr(ring[i].addr.ip) << ", its frame was given up" << std::endl;
+                }
             }
+        }
+    }
+}
 
-            // Check Data CRC
-            int computedCrc = 0;
-            for (auto v: allData) {
-                computedCrc += v;
+int main(int argc, char** argv)
+{
+    // --gro: let the kernel coalesce chunks of a frame (UDP receive offload, Linux only)
+    // --rcvbuf <bytes>: socket receive buffer size, large enough to absorb bursts of chunks
+    // --timestamps: use kernel arrival times to log frame reassembly time and socket to pickup delay
+    // --io-uring: receive through io_uring registered buffers instead of recvmmsg (Linux only)
+    // --threads <count>: one socket and one thread per core, each sender always handled by the same thread
+    //                    (Linux only, unicast only)
+    // --multicast [group]: also receive frames sent to a multicast group (default PONK_DEFAULT_MULTICAST_GROUP)
+    // --interface <ip>: network interface on which the multicast group is joined (0.0.0.0 lets the OS choose)
+    // --wait <blocking|hybrid|spin>: park in the kernel when idle, spin a while after each burst then park,
+    //                                or always spin. Spinning modes busy poll the adapter (SO_BUSY_POLL, Linux only)
+    //                                Wake latency measured from kernel timestamps is reported to compare modes
+    // --spin-us <microseconds>: spin budget of the hybrid mode
+    // --filter: let the kernel drop non PONK datagrams and unsupported protocol versions (Linux only)
+    // --allow-ip <ip>, --allow-sender <identifier>: with --filter, only accept datagrams from these source
+    //                                               addresses or sender identifiers (repeatable)
+    // --render-fps <fps>: rate at which the render thread takes frames, to see how a slow consumer only gets
+    //                     the newest ones (default: as soon as they are complete)
+    // --stats-json <file>: write per sender rates, losses, CRC failures and latency percentiles as a JSON line
+    //                      every second ("-" for standard output). Enables kernel timestamps for latencies
+    bool useReceiveCoalescing = false;
+    bool useReceiveFilter = false;
+    DatagramFilter receiveFilter;
+    WaitMode waitMode = WaitMode::Blocking;
+    bool reportWakeLatency = false;
+    int spinBudgetMicroseconds = 200;
+    int renderFps = 0;
+    std::string statsPath;
+    unsigned int threadCount = 1;
+    bool useMulticast = false;
+    unsigned int multicastGroup = PONK_DEFAULT_MULTICAST_GROUP;
+    unsigned int networkInterfaceIp = 0;
+    bool validArguments = true;
+    DatagramSocketOptions socketOptions;
+    socketOptions.receiveBufferSize = 4 * 1024 * 1024;
+    socketOptions.reportKernelDrops = true;
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i],"--gro") == 0) {
+            useReceiveCoalescing = true;
+        } else if (strcmp(argv[i],"--rcvbuf") == 0 && i+1 < argc) {
+            socketOptions.receiveBufferSize = atoi(argv[++i]);
+        } else if (strcmp(argv[i],"--timestamps") == 0) {
+            socketOptions.receiveTimestamps = true;
+        } else if (strcmp(argv[i],"--io-uring") == 0) {
+            socketOptions.receiveBackend = DatagramReceiveBackend::IoUring;
+        } else if (strcmp(argv[i],"--threads") == 0 && i+1 < argc) {
+            threadCount = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i],"--multicast") == 0) {
+            useMulticast = true;
+            if (i+1 < argc && strncmp(argv[i+1],"--",2) != 0) {
+                validArguments = ipStrToInt(argv[++i],multicastGroup) && isMulticastIp(multicastGroup);
             }
-            if (computedCrc != header->dataCrc) {
-                std::cout << "Error: invalid data CRC, ignoring frame";
-                assert(false);
-                continue;
+        } else if (strcmp(argv[i],"--interface") == 0 && i+1 < argc) {
+            validArguments = ipStrToInt(argv[++i],networkInterfaceIp);
+        } else if (strcmp(argv[i],"--wait") == 0 && i+1 < argc) {
+            const std::string mode = argv[++i];
+            reportWakeLatency = true;
+            if (mode == "blocking") {
+                waitMode = WaitMode::Blocking;
+            } else if (mode == "hybrid") {
+                waitMode = WaitMode::Hybrid;
+            } else if (mode == "spin") {
+                waitMode = WaitMode::Spin;
+            } else {
+                validArguments = false;
             }
+        } else if (strcmp(argv[i],"--spin-us") == 0 && i+1 < argc) {
+            spinBudgetMicroseconds = std::max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i],"--filter") == 0) {
+            useReceiveFilter = true;
+        } else if (strcmp(argv[i],"--allow-ip") == 0 && i+1 < argc) {
+            unsigned int ip = 0;
+            validArguments = ipStrToInt(argv[++i],ip);
+            receiveFilter.sourceIps.push_back(ip);
+        } else if (strcmp(argv[i],"--allow-sender") == 0 && i+1 < argc) {
+            receiveFilter.senderKeys.push_back(static_cast<unsigned int>(strtoul(argv[++i],nullptr,10)));
+        } else if (strcmp(argv[i],"--render-fps") == 0 && i+1 < argc) {
+            renderFps = std::max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i],"--stats-json") == 0 && i+1 < argc) {
+            statsPath = argv[++i];
+        } else {
+            validArguments = false;
+        }
+        if (!validArguments) {
+            std::cout << "Usage: " << argv[0] << " [--gro] [--rcvbuf <bytes>] [--timestamps] [--io-uring] [--threads <count>]"
+                      << " [--multicast [group]] [--interface <ip>] [--wait <blocking|hybrid|spin>] [--spin-us <microseconds>]"
+                      << " [--filter [--allow-ip <ip>]... [--allow-sender <identifier>]...] [--render-fps <fps>]"
+                      << " [--stats-json <file>]" << std::endl;
+            return -1;
+        }
+    }
+    if (waitMode != WaitMode::Blocking) {
+        socketOptions.busyPollMicroseconds = waitMode == WaitMode::Spin ? 50 : std::max(1, std::min(50, spinBudgetMicroseconds));
+    }
+    if (reportWakeLatency || !statsPath.empty()) {
+        socketOptions.receiveTimestamps = true;
+    }
+    std::ofstream statsFile;
+    std::ostream* statsOutput = nullptr;
+    if (statsPath == "-") {
+        statsOutput = &std::cout;
+    } else if (!statsPath.empty()) {
+        statsFile.open(statsPath, std::ios::out | std::ios::app);
+        if (!statsFile) {
+            std::cout << "Can't open " << statsPath << std::endl;
+            return -1;
+        }
+        statsOutput = &statsFile;
+    }
 
-            unsigned int dataOffset = 0;
-
-            // Read Pathes
-            struct Path {
-                struct Point {
-                    float x,y,r,g,b;
-                };
-                std::vector<Point> points;
-            };
-
-            // Loop over pathes until there's no more data to read
-            std::vector<Path> pathes;
-            while (dataOffset < dataSize) {
-                // Read data format
-                const auto dataFormat = allData[dataOffset];
-                dataOffset++;
-
-                // Read Meta Data Count
-                if (dataSize < dataOffset+1) {
-                    std::cout << "Error: not enough data to read path meta data count" << std::endl;
-                    break;
-                }
-                const unsigned short metaDataCount = allData[dataOffset];
-                dataOffset++;
-
-                // Read Meta Data
-                if (dataSize < dataOffset+12 * metaDataCount) {
-                    std::cout << "Error: not enough data to read path meta data" << std::endl;
-                    break;
-                }
-                for (int idx=0; idx<metaDataCount; idx++) {
-                    // Not that we don't know what value type is carried. Sender and Receiver
-                    // should know what value type to transfer for a meta. Receiver
-                    // should check meta value is in acceptable range
-                    std::string metaName((char*)&allData[dataOffset],8);
-                    dataOffset += 8;
-                    const auto floatValue = *reinterpret_cast<float*>(&allData[dataOffset]);
-                    dataOffset += 4;
-                    std::cout << "Path Meta " << metaName << " = " << floatValue << std::endl;
-                }
-
-                // Read Point Count
-                if (dataSize < dataOffset+2) {
-                    std::cout << "Error: not enough data to read path point count" << std::endl;
-                    break;
-                }
-                const unsigned short pointCount = allData[dataOffset] + (allData[dataOffset+1]<<8);
-                std::cout << "  -> Path " << std::to_string(pathes.size()) << " / Point Count = " << std::to_string(pointCount) << std::endl;
-                dataOffset += 2;
-
-                unsigned char bytesPerPoint;
-                if (dataFormat == PONK_DATA_FORMAT_XYRGB_U16) {
-                    bytesPerPoint = 5 * sizeof(unsigned short);
-                } else if (dataFormat == PONK_DATA_FORMAT_XY_F32_RGB_U8) {
-                    bytesPerPoint = 2 * sizeof(float) + 3 * sizeof(unsigned char);
-                } else {
-                    std::cout << "Error: unhandled data format: " << dataFormat << std::endl;
-                    break;
-                }
-
-                if (dataSize < dataOffset + pointCount * bytesPerPoint) {
-                    std::cout << "Error: not enough data to read path points" << std::endl;
-                    break;
-                }
-
-                Path path;
-                for (int i=0; i<pointCount; i++) {
-                    Path::Point point;
-
-                    if (dataFormat == PONK_DATA_FORMAT_XYRGB_U16) {
-                        unsigned short x16bits = allData[dataOffset] + (allData[dataOffset+1]<<8);
-                        dataOffset += 2;
-                        unsigned short y16bits = allData[dataOffset] + (allData[dataOffset+1]<<8);
-                        dataOffset += 2;
-                        unsigned short r16bits = allData[dataOffset] + (allData[dataOffset+1]<<8);
-                        dataOffset += 2;
-                        unsigned short g16bits = allData[dataOffset] + (allData[dataOffset+1]<<8);
-                        dataOffset += 2;
-                        unsigned short b16bits = allData[dataOffset] + (allData[dataOffset+1]<<8);
-                        dataOffset += 2;
+    // Headers are still checked in user space, the kernel filter only spares waking up for stray traffic
+    receiveFilter.payloadPrefix = std::string(PONK_HEADER_STRING, sizeof(GeomUdpHeader::headerString));
+    receiveFilter.maxByteOffset = offsetof(GeomUdpHeader, protocolVersion);
+    receiveFilter.maxByteValue = PONK_PROTOCOL_VERSION;
+    receiveFilter.senderKeyOffset = offsetof(GeomUdpHeader, senderIdentifier);
+
+    // Multicast datagrams are delivered to every socket of a SO_REUSEPORT group, steering doesn't apply to them:
+    // each thread would reassemble and render every multicast frame
+    if (useMulticast && threadCount > 1) {
+        std::cout << "--threads can't be used with --multicast, every thread would get every multicast frame" << std::endl;
+        return -1;
+    }
 
-                        point.x = -1+2*(x16bits/65535.f);
-                        point.y = -1+2*(y16bits/65535.f);
-                        point.r = r16bits/65535.f;
-                        point.g = g16bits/65535.f;
-                        point.b = b16bits/65535.f;
-                    } else if (dataFormat == PONK_DATA_FORMAT_XY_F32_RGB_U8) {
-                        point.x = *reinterpret_cast<float*>(&allData[dataOffset]);
-                        dataOffset += sizeof(float);
-                        point.y = *reinterpret_cast<float*>(&allData[dataOffset]);
-                        dataOffset += sizeof(float);
-                        point.r = allData[dataOffset];
-                        dataOffset++;
-                        point.g = allData[dataOffset];
-                        dataOffset++;
-                        point.b = allData[dataOffset];
-                        dataOffset++;
-                    }
+    std::cout << "Starting" << std::endl;
 
-                    path.points.push_back(point);
-                }
+    // Sockets share the port (SO_REUSEPORT). Chunks of a frame must all reach the same socket for
+    // reassembly, so the kernel is told to steer each sender to a single socket
+    std::vector<std::unique_ptr<DatagramSocket>> sockets;
+    for (unsigned int i=0; i<threadCount; i++) {
+        sockets.push_back(std::unique_ptr<DatagramSocket>(new DatagramSocket(INADDR_ANY,PONK_PORT,socketOptions)));
+    }
+    if (threadCount > 1 && !sockets[0]->setReusePortSteering(threadCount)) {
+        std::cout << "Sender steering is not available, receiving on a single thread" << std::endl;
+        sockets.resize(1);
+    }
+    for (auto& socket: sockets) {
+        if (useReceiveCoalescing && !socket->setReceiveCoalescing(true)) {
+            std::cout << "Receive coalescing is not available, receiving datagrams one by one" << std::endl;
+        }
+        if (useReceiveFilter && !socket->setReceiveFilter(receiveFilter)) {
+            std::cout << "Kernel packet filter is not available, every datagram is checked in user space" << std::endl;
+        }
+        // Sockets are bound to INADDR_ANY, unicast frames keep being received along multicast ones
+        if (useMulticast && !socket->joinMulticastGroup(multicastGroup,networkInterfaceIp)) {
+            return -1;
+        }
+    }
 
-                pathes.push_back(path); // Note that this is very inefficient
-            }
+    // Each thread reassembles frames of its own senders and publishes them to its own mailboxes, no state is
+    // shared between network threads
+    std::vector<std::unique_ptr<PonkFrameMailboxes>> mailboxes;
+    for (size_t i=0; i<sockets.size(); i++) {
+        mailboxes.push_back(std::unique_ptr<PonkFrameMailboxes>(new PonkFrameMailboxes()));
+    }
+    PonkReceiverStats receiverStats;
+    std::vector<std::thread> threads;
+    threads.push_back(std::thread(renderLoop, std::cref(mailboxes), renderFps, std::ref(receiverStats), statsOutput));
+    for (size_t i=1; i<sockets.size(); i++) {
+        threads.push_back(std::thread(receiveLoop, std::ref(*sockets[i]), std::ref(*mailboxes[i]), std::ref(receiverStats), waitMode, spinBudgetMicroseconds));
+    }
+    receiveLoop(*sockets[0], *mailboxes[0], receiverStats, waitMode, spinBudgetMicroseconds);
 
-            assert(dataOffset == dataSize);
-        }
+    for (auto& thread: threads) {
+        thread.join();
     }
 
     return 0;
@@ -3,7 +3,11 @@
 #include <vector>
 #include <cmath>
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
 #include "DatagramSocket/DatagramSocket.h"
+#include "PonkChecksum/PonkChecksum.h"
+#include "PonkMetaData/PonkMetaData.h"
 #include "PonkDefs.h"
 #ifndef M_PI // M_PI not defined on Windows
     #define M_PI 3.14159265358979323846
@@ -29,26 +33,109 @@ void push32bits(std::vector<unsigned char>& fullData, float value) {
     push32bits(fullData,*reinterpret_cast<int*>(&value));
 }
 
-void pushMetaData(std::vector<unsigned char>& fullData, const char (&eightCC)[9],float value) {
+void pushMetaData(std::vector<unsigned char>& fullData, PonkMetaDataKey key,float value) {
     for (int i=0; i<8; i++) {
-        fullData.push_back(eightCC[i]);
+        fullData.push_back(static_cast<unsigned char>((key>>(8*i)) & 0xFF));
     }
-    push32bits(fullData,*(int*)&value);
+    push32bits(fullData,value);
 }
 
-int main()
+int main(int argc, char** argv)
 {
+    // --gso: let the kernel split frames in chunks (UDP segmentation offload, Linux only)
+    // --multicast [group]: send each frame once to a multicast group (default PONK_DEFAULT_MULTICAST_GROUP)
+    //                      instead of unicast to localhost, every receiver that joined the group gets it
+    // --ttl <hops>: multicast TTL, 1 keeps datagrams on the local network
+    // --no-loopback: don't deliver multicast datagrams to receivers running on this host
+    // --interface <ip>: network interface used to send multicast datagrams
+    // --zerocopy: frames of 256 KB or more are sent without copying them in kernel memory (MSG_ZEROCOPY, Linux only).
+    //             Frames of this sample are about 11 KB and always copied: below that size pinning pages and reading
+    //             completions costs more than the copy. Shows how a sender of large frames enables it
+    // --pace [bytes/s]: spread chunks over time instead of sending each frame as a single burst, by default
+    //                   each frame is spread over 3/4 of the frame interval
+    // --burst <bytes>: with --pace, bytes sent back to back at most (default 8 chunks)
+    bool useSegmentationOffload = false;
+    bool useZeroCopy = false;
+    bool useMulticast = false;
+    unsigned int multicastGroup = PONK_DEFAULT_MULTICAST_GROUP;
+    unsigned int multicastInterfaceIp = 0;
+    int multicastTtl = 1;
+    bool multicastLoopback = true;
+    bool usePacing = false;
+    unsigned long long pacingRate = 0; // 0: computed from the frame size
+    unsigned int pacingBurst = 8 * (sizeof(GeomUdpHeader) + PONK_MAX_DATA_BYTES_PER_PACKET);
+    bool validArguments = true;
+    for (int i=1; i<argc && validArguments; i++) {
+        if (strcmp(argv[i],"--gso") == 0) {
+            useSegmentationOffload = true;
+        } else if (strcmp(argv[i],"--multicast") == 0) {
+            useMulticast = true;
+            if (i+1 < argc && strncmp(argv[i+1],"--",2) != 0) {
+                validArguments = ipStrToInt(argv[++i],multicastGroup) && isMulticastIp(multicastGroup);
+            }
+        } else if (strcmp(argv[i],"--ttl") == 0 && i+1 < argc) {
+            multicastTtl = atoi(argv[++i]);
+        } else if (strcmp(argv[i],"--zerocopy") == 0) {
+            useZeroCopy = true;
+        } else if (strcmp(argv[i],"--no-loopback") == 0) {
+            multicastLoopback = false;
+        } else if (strcmp(argv[i],"--interface") == 0 && i+1 < argc) {
+            validArguments = ipStrToInt(argv[++i],multicastInterfaceIp);
+        } else if (strcmp(argv[i],"--pace") == 0) {
+            usePacing = true;
+            if (i+1 < argc && strncmp(argv[i+1],"--",2) != 0) {
+                pacingRate = strtoull(argv[++i],nullptr,10);
+                validArguments = pacingRate > 0;
+            }
+        } else if (strcmp(argv[i],"--burst") == 0 && i+1 < argc) {
+            pacingBurst = static_cast<unsigned int>(atoi(argv[++i]));
+            validArguments = pacingBurst > 0;
+        } else {
+            validArguments = false;
+        }
+    }
+    if (!validArguments) {
+        std::cout << "Usage: " << argv[0] << " [--gso] [--multicast [group]] [--ttl <hops>] [--no-loopback] [--interface <ip>] [--zerocopy] [--pace [bytes/s]] [--burst <bytes>]" << std::endl;
+        return -1;
+    }
+
     std::cout << "Starting" << std::endl;
 
-    DatagramSocket socket(INADDR_ANY,0);
+    // Send buffer large enough to queue every chunk of the biggest frame (255 chunks)
+    DatagramSocketOptions socketOptions;
+    socketOptions.sendBufferSize = 4 * 1024 * 1024;
+    if (useZeroCopy) {
+        socketOptions.zeroCopyThreshold = 256 * 1024;
+    }
+    DatagramSocket socket(INADDR_ANY,0,socketOptions);
+    if (useMulticast && !socket.setMulticastOutput(multicastInterfaceIp,multicastTtl,multicastLoopback)) {
+        return -1;
+    }
 
     // send a moving circle and a triangle in loop
     double animTime = 0;
     auto nextFrametime = std::chrono::system_clock::now();
     unsigned char frameNumber = 0;
+    unsigned long long configuredPacingRate = 0;
+    std::vector<GeomUdpHeader> headers;
+    std::vector<DatagramChunk> chunks;
+    std::vector<unsigned char> segmentedData;
+    std::vector<unsigned char> fullData;
+    fullData.reserve(65536);
     while (true) {
-        std::vector<unsigned char> fullData;
-        fullData.reserve(65536);
+        // Zero copy sends of the previous frame may still read these buffers
+        if (!socket.waitZeroCopyCompletions(100000)) {
+            std::cout << "Warning: kernel still holds the previous frame buffers" << std::endl;
+        }
+        fullData.clear();
+
+        // Data CRC, updated with each path right after it's serialized while it's still in cache
+        unsigned int dataCrc = 0;
+        size_t checksummedBytes = 0;
+        const auto checksumNewData = [&]() {
+            dataCrc = ponkChecksum(fullData.data() + checksummedBytes,fullData.size() - checksummedBytes,dataCrc);
+            checksummedBytes = fullData.size();
+        };
 
         #ifdef USE_PONK_DATA_FORMAT_XYRGB_U16
             // Generate circle data with 1024 points
@@ -56,8 +143,8 @@ int main()
 
             // Meta Data
             fullData.push_back(2); // Write meta data count
-            pushMetaData(fullData,"PATHNUMB",1.f);
-            pushMetaData(fullData,"MAXSPEED",0.1f);
+            pushMetaData(fullData,ponkEightCC("PATHNUMB"),1.f);
+            pushMetaData(fullData,ponkEightCC("MAXSPEED"),0.1f);
 
             // Write point count - LSB first
             #define CIRCLE_POINT_COUNT 1024
@@ -86,13 +173,14 @@ int main()
                 // Push B - LSB first
                 push16bits(fullData,0xFFFF);
             }
+            checksumNewData();
 
             // Generate a triangle with 4 points (to close it)
             fullData.push_back(PONK_DATA_FORMAT_XYRGB_U16); // Write Format Data
 
             // Meta Data
             fullData.push_back(1); // Write meta data count
-            pushMetaData(fullData,"PATHNUMB",2.f);
+            pushMetaData(fullData,ponkEightCC("PATHNUMB"),2.f);
 
             // Write point count - LSB first
             #define TRIANGLE_POINT_COUNT 4
@@ -117,14 +205,15 @@ int main()
                 // Push B - LSB first
                 push16bits(fullData,0);
             }
+            checksumNewData();
         #else
             // Generate circle data with 1024 points
             fullData.push_back(PONK_DATA_FORMAT_XY_F32_RGB_U8); // Write Format Data
 
             // Meta Data
             fullData.push_back(2); // Write meta data count
-            pushMetaData(fullData,"PATHNUMB",1.f);
-            pushMetaData(fullData,"MAXSPEED",1.0f);
+            pushMetaData(fullData,ponkEightCC("PATHNUMB"),1.f);
+            pushMetaData(fullData,ponkEightCC("MAXSPEED"),1.0f);
 
             // Write point count - LSB first
             #define CIRCLE_POINT_COUNT 1024
@@ -151,6 +240,7 @@ int main()
                 // Push B - LSB first
                 push8bits(fullData,0xFF);
             }
+            checksumNewData();
 
             // Generate a triangle with 4 points (to close it)
             // Generate circle data with 1024 points
@@ -158,7 +248,7 @@ int main()
 
             // Meta Data
             fullData.push_back(1); // Write meta data count
-            pushMetaData(fullData,"PATHNUMB",2.f);
+            pushMetaData(fullData,ponkEightCC("PATHNUMB"),2.f);
 
             // Write point count - LSB first
             #define TRIANGLE_POINT_COUNT 4
@@ -180,29 +270,25 @@ int main()
                 // Push B - LSB first
                 push8bits(fullData,0);
             }
+            checksumNewData();
         #endif
 
         // Compute necessary chunk count
-        size_t chunksCount64 = 1 + fullData.size() / PONK_MAX_DATA_BYTES_PER_PACKET;
+        size_t chunksCount64 = (fullData.size() + PONK_MAX_DATA_BYTES_PER_PACKET - 1) / PONK_MAX_DATA_BYTES_PER_PACKET;
         if (chunksCount64 > 255) {
             throw std::runtime_error("Protocol doesn't accept sending "
                                      "a packet that would be splitted "
                                      "in more than 255 chunks");
         }
 
-        // Compute data CRC
-        unsigned int dataCrc = 0;
-        for (auto v: fullData) {
-            dataCrc += v;
-        }
-
-        // Send all chunks to the desired IP address
+        // Prepare one header per chunk, chunk payloads point straight into fullData
+        headers.resize(chunksCount64);
+        chunks.resize(chunksCount64);
         size_t written = 0;
-        unsigned char chunkNumber = 0;
         unsigned char chunksCount = static_cast<unsigned char>(chunksCount64);
-        while (written < fullData.size()) {
-            // Write packet header - 8 bytes
-            GeomUdpHeader header;
+        for (unsigned char chunkNumber=0; chunkNumber<chunksCount; chunkNumber++) {
+            // Write packet header
+            GeomUdpHeader& header = headers[chunkNumber];
             strncpy(header.headerString,PONK_HEADER_STRING,sizeof(header.headerString));
             header.protocolVersion = 0;
             header.senderIdentifier = 123123; // Unique ID (so when changing name in sender, the receiver can just rename existing stream)
@@ -212,28 +298,63 @@ int main()
             header.chunkNumber = chunkNumber;
             header.dataCrc = dataCrc;
 
-            // Prepare buffer
-            std::vector<unsigned char> packet;
             size_t dataBytesForThisChunk = std::min<size_t>(fullData.size()-written, PONK_MAX_DATA_BYTES_PER_PACKET);
-            packet.resize(sizeof(GeomUdpHeader) + dataBytesForThisChunk);
-            // Write header
-            memcpy(&packet[0],&header,sizeof(GeomUdpHeader));
-            // Write data
-            memcpy(&packet[sizeof(GeomUdpHeader)],&fullData[written],dataBytesForThisChunk);
+            DatagramChunk& chunk = chunks[chunkNumber];
+            chunk.header = &header;
+            chunk.headerLen = sizeof(GeomUdpHeader);
+            chunk.payload = &fullData[written];
+            chunk.payloadLen = static_cast<unsigned int>(dataBytesForThisChunk);
             written += dataBytesForThisChunk;
+        }
 
-            // Now send chunk packet
+        // Now send all chunk packets in a single call
+        if (chunksCount > 0) {
             GenericAddr destAddr;
             destAddr.family = AF_INET;
-            // Unicast on localhost 127.0.0.1
-            destAddr.ip = ((127 << 24) + (0 << 16) + (0 << 8) + 1);
+            // Multicast: frame is serialized and sent once whatever the receiver count
+            // Unicast on localhost 127.0.0.1 otherwise
+            destAddr.ip = useMulticast ? multicastGroup : ((127 << 24) + (0 << 16) + (0 << 8) + 1);
             destAddr.port = PONK_PORT;
-            socket.sendTo(destAddr, &packet.front(), static_cast<unsigned int>(packet.size()));
-
-            chunkNumber++;
+            // Fixed destination: a connected socket skips the route lookup for each chunk
+            socket.connectTo(destAddr);
+            if (usePacing) {
+                // A single lost chunk drops the whole frame: don't let a big frame overflow switch
+                // buffers or the receiver socket queue in one burst
+                unsigned long long rate = pacingRate;
+                if (rate == 0) {
+                    const unsigned long long frameBytes = chunksCount * sizeof(GeomUdpHeader) + fullData.size();
+                    rate = frameBytes * 60 * 4 / 3;
+                }
+                // Reconfigured only when the rate changes: each call is a setsockopt
+                if (rate != configuredPacingRate) {
+                    socket.setPacing(rate, pacingBurst);
+                    configuredPacingRate = rate;
+                }
+            }
+            if (useSegmentationOffload) {
+                // Lay chunks out back to back: all chunks but the last one have the same size,
+                // so the kernel can cut the buffer at a fixed stride and datagrams stay identical on the wire
+                segmentedData.clear();
+                for (const auto& chunk: chunks) {
+                    const auto header = static_cast<const unsigned char*>(chunk.header);
+                    const auto payload = static_cast<const unsigned char*>(chunk.payload);
+                    segmentedData.insert(segmentedData.end(), header, header + chunk.headerLen);
+                    segmentedData.insert(segmentedData.end(), payload, payload + chunk.payloadLen);
+                }
+                socket.sendSegmented(destAddr, &segmentedData[0], static_cast<unsigned int>(segmentedData.size()),
+                                     sizeof(GeomUdpHeader) + PONK_MAX_DATA_BYTES_PER_PACKET);
+            } else {
+                socket.sendBatch(destAddr, &chunks[0], chunksCount);
+            }
         }
 
         std::cout << "Sent frame " << std::to_string(frameNumber) << std::endl;
+        if (frameNumber % 60 == 59) {
+            const DatagramSocketStats stats = socket.stats();
+            std::cout << "Socket: " << stats.packetsSent << " datagrams / " << stats.bytesSent << " bytes sent, "
+                      << stats.sendErrors << " errors (" << stats.sendWouldBlock << " would block), "
+                      << stats.shortSends << " short sends" << std::endl;
+        }
 
         animTime += 1/60.;
         frameNumber++;
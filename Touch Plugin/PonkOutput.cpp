@@ -1,10 +1,12 @@
 #include "PonkOutput.h"
+#include "PonkChecksum/PonkChecksum.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
 #include <assert.h>
 #include <iostream>
+#include <algorithm>
 
 #ifndef M_PI // M_PI not defined on Windows
 	#define M_PI 3.14159265358979323846
@@ -78,7 +80,10 @@ PonkOutput::PonkOutput(const OP_NodeInfo* info) : myNodeInfo(info)
 
 	myDat = "N/A";
 
-	socket = new DatagramSocket (INADDR_ANY, 0);;
+	// Send buffer large enough to queue every chunk of the biggest frame (255 chunks)
+	DatagramSocketOptions socketOptions;
+	socketOptions.sendBufferSize = 4 * 1024 * 1024;
+	socket = new DatagramSocket (INADDR_ANY, 0, socketOptions);
 }
 
 PonkOutput::~PonkOutput()
@@ -116,17 +121,11 @@ void PonkOutput::pushFloat32(std::vector<unsigned char>& fullData, float value)
     push32bits(fullData,asInt);
 }
 
-void PonkOutput::pushMetaData(std::vector<unsigned char>& fullData, const char(&eightCC)[9], int value) {
+void PonkOutput::pushMetaData(std::vector<unsigned char>& fullData, PonkMetaDataKey key, float value) {
 	for (int i = 0; i < 8; i++) {
-		fullData.push_back(eightCC[i]);
+		fullData.push_back(static_cast<unsigned char>((key >> (8 * i)) & 0xFF));
 	}
-	push32bits(fullData, value);
-}
-void PonkOutput::pushMetaData(std::vector<unsigned char>& fullData, const char(&eightCC)[9], float value) {
-	for (int i = 0; i < 8; i++) {
-		fullData.push_back(eightCC[i]);
-	}
-	push32bits(fullData, *(int*)&value);
+	pushFloat32(fullData, value);
 }
 
 void PonkOutput::pushPoint_XY_F32_RGB_U8(std::vector<unsigned char>& fullData, const Position& pointPosition, const Color& pointColor) {
@@ -209,20 +208,16 @@ bool PonkOutput::validatePrimitiveDat(const OP_DATInput* primitive, int numPrimi
 }
 
 
-std::map<std::string, float> PonkOutput::getMetadata(const OP_DATInput* primitive, int primitiveIndex) {
-	std::map<std::string, float> metadata;
-	
-	// check how many metadata attribute the primitive dat contains
-	int numMetadata = primitive->numCols - 4;
+void PonkOutput::getMetadataKeys(const OP_DATInput* primitive) {
+	metadataKeys.clear();
 
-	// get the metadata from the dat
+	// check how many metadata attribute the primitive dat contains, a path can't have more than 255
+	int numMetadata = std::min(primitive->numCols - 4, 255);
+
+	// column names are the keys, the same for all primitives
 	for (int i = 0; i < numMetadata; i++) {
-		std::string metadataName = primitive->getCell(0, 3 + i);
-		float metadataValue = (float)std::strtod(primitive->getCell(primitiveIndex + 1, 3 + i), NULL);
-		metadata[metadataName] = metadataValue;
+		metadataKeys.push_back(ponkMetaDataKey(primitive->getCell(0, 3 + i)));
 	}
-
-	return metadata;
 }
 
 Matrix44<double>
@@ -303,6 +298,9 @@ PonkOutput::execute(SOP_Output* output, const OP_Inputs* inputs, void* reserved)
 		std::vector<unsigned char> fullData;
 		fullData.reserve(65536);
 
+		// Packet CRC, updated with each primitive right after it's serialized while it's still in cache
+		unsigned int dataCrc = 0;
+
 		// Check that the primitive dat is valid
 		if(validatePrimitiveDat(primitive, sinput->getNumPrimitives()))
 		{
@@ -313,24 +311,23 @@ PonkOutput::execute(SOP_Output* output, const OP_Inputs* inputs, void* reserved)
 				colors = sinput->getColors()->colors;
 			}
 
+			getMetadataKeys(primitive);
+
 			for (int primitiveNumber = 0; primitiveNumber < sinput->getNumPrimitives(); primitiveNumber++)
 			{
+				const size_t primitiveOffset = fullData.size();
 				//std::cout << "-------------------- primitive : " << i << std::endl;
 
                 // Write Format Data
                 fullData.push_back(PONK_DATA_FORMAT_XY_F32_RGB_U8);
 
-				// get the metadata
-				std::map<std::string, float> metadata = getMetadata(primitive, primitiveNumber);
-
 				// Write meta data count
-				fullData.push_back(metadata.size());
+				fullData.push_back(static_cast<unsigned char>(metadataKeys.size()));
 
-				for (const auto& kv : metadata) {
-					char charMetadata[9];
-					std::copy(kv.first.begin(), kv.first.end(), charMetadata);
-
-					pushMetaData(fullData, charMetadata, kv.second);
+				// get the metadata values of this primitive
+				for (size_t i = 0; i < metadataKeys.size(); i++) {
+					const float metadataValue = (float)std::strtod(primitive->getCell(primitiveNumber + 1, 3 + static_cast<int>(i)), NULL);
+					pushMetaData(fullData, metadataKeys[i], metadataValue);
 				}
 
 				const SOP_PrimitiveInfo primInfo = sinput->getPrimitive(primitiveNumber);
@@ -363,6 +360,8 @@ PonkOutput::execute(SOP_Output* output, const OP_Inputs* inputs, void* reserved)
                     pushPoint_XY_F32_RGB_U8(fullData, pointPosition, sinput->hasColors()?colors[primVert[0]]:s_white);
 
 				}
+
+				dataCrc = ponkChecksum(fullData.data() + primitiveOffset, fullData.size() - primitiveOffset, dataCrc);
 			}
 		}
 		else
@@ -371,7 +370,8 @@ PonkOutput::execute(SOP_Output* output, const OP_Inputs* inputs, void* reserved)
 		}
 
 		// Check if we don't reach the maximum number of chunck
-		size_t chunksCount64 = 1 + fullData.size() / PONK_MAX_DATA_BYTES_PER_PACKET;
+		const size_t maxDataBytesPerChunk = PONK_MAX_DATA_BYTES_PER_PACKET - sizeof(GeomUdpHeader);
+		size_t chunksCount64 = (fullData.size() + maxDataBytesPerChunk - 1) / maxDataBytesPerChunk;
 		if (chunksCount64 > 255) {
 			throw std::runtime_error("Protocol doesn't accept sending "
 				"a packet that would be splitted "
@@ -386,18 +386,14 @@ PonkOutput::execute(SOP_Output* output, const OP_Inputs* inputs, void* reserved)
 		int uid = inputs->getParInt("Uid");
 		//std::cout << "Uid " << uid << std::endl;
 
-        // Compute packet CRC
-        unsigned int dataCrc = 0;
-        for (auto v: fullData) {
-            dataCrc += v;
-        }
-
+		// Prepare one header per chunk, chunk payloads point straight into fullData
+		chunkHeaders.resize(chunksCount64);
+		chunks.resize(chunksCount64);
 		size_t written = 0;
-		unsigned char chunkNumber = 0;
 		unsigned char chunksCount = static_cast<unsigned char>(chunksCount64);
-		while (written < fullData.size()) {
-			// Write packet header - 8 bytes
-			GeomUdpHeader header;
+		for (unsigned char chunkNumber = 0; chunkNumber < chunksCount; chunkNumber++) {
+			// Write packet header
+			GeomUdpHeader& header = chunkHeaders[chunkNumber];
 			strncpy(header.headerString, PONK_HEADER_STRING, sizeof(header.headerString));
 			header.protocolVersion = 0;
 			header.senderIdentifier = uid; // Unique ID (so when changing name in sender, the receiver can just rename existing stream)
@@ -407,26 +403,61 @@ PonkOutput::execute(SOP_Output* output, const OP_Inputs* inputs, void* reserved)
 			header.chunkNumber = chunkNumber;
             header.dataCrc = dataCrc;
 
-			// Prepare buffer
-			std::vector<unsigned char> packet;
-			size_t dataBytesForThisChunk = std::min<size_t>(fullData.size() - written, PONK_MAX_DATA_BYTES_PER_PACKET-sizeof(GeomUdpHeader));
-			packet.resize(sizeof(GeomUdpHeader) + dataBytesForThisChunk);
-			// Write header
-			memcpy(&packet[0], &header, sizeof(GeomUdpHeader));
-			// Write data
-			memcpy(&packet[sizeof(GeomUdpHeader)], &fullData[written], dataBytesForThisChunk);
+			size_t dataBytesForThisChunk = std::min<size_t>(fullData.size() - written, maxDataBytesPerChunk);
+			DatagramChunk& chunk = chunks[chunkNumber];
+			chunk.header = &header;
+			chunk.headerLen = sizeof(GeomUdpHeader);
+			chunk.payload = &fullData[written];
+			chunk.payloadLen = static_cast<unsigned int>(dataBytesForThisChunk);
 			written += dataBytesForThisChunk;
+		}
 
-			// Now send chunk packet
+		// Now send all chunk packets in a single call
+		if (chunksCount > 0) {
 			GenericAddr destAddr;
 			destAddr.family = AF_INET;
 
-            // Unicast UDP
-			destAddr.ip = ((ip[0] << 24) + (ip[1] << 16) + (ip[2] << 8) + ip[3]);
+			if (inputs->getParInt("Multicast")) {
+				// Multicast UDP: the frame is sent once whatever the number of receivers in the group
+				int group[4];
+				inputs->getParInt4("Multicastgroup", group[0], group[1], group[2], group[3]);
+				destAddr.ip = ((group[0] << 24) + (group[1] << 16) + (group[2] << 8) + group[3]);
+
+				int itf[4];
+				inputs->getParInt4("Multicastinterface", itf[0], itf[1], itf[2], itf[3]);
+				MulticastOutput requestedMulticast;
+				requestedMulticast.interfaceIp = ((itf[0] << 24) + (itf[1] << 16) + (itf[2] << 8) + itf[3]);
+				requestedMulticast.ttl = inputs->getParInt("Multicastttl");
+				requestedMulticast.loopback = inputs->getParInt("Multicastloopback") != 0;
+				if (!multicastOutputApplied || requestedMulticast.interfaceIp != multicastOutput.interfaceIp ||
+					requestedMulticast.ttl != multicastOutput.ttl || requestedMulticast.loopback != multicastOutput.loopback) {
+					multicastOutputApplied = socket->setMulticastOutput(requestedMulticast.interfaceIp, requestedMulticast.ttl, requestedMulticast.loopback);
+					multicastOutput = requestedMulticast;
+				}
+			} else {
+				// Unicast UDP
+				destAddr.ip = ((ip[0] << 24) + (ip[1] << 16) + (ip[2] << 8) + ip[3]);
+			}
 			destAddr.port = PONK_PORT;
-			socket->sendTo(destAddr, &packet[0], static_cast<unsigned int>(packet.size()));
 
-			chunkNumber++;
+			// Destination rarely changes: a connected socket skips the route lookup for each chunk
+			// (no-op while connected to the same address, reconnects when the parameter changes)
+			socket->connectTo(destAddr);
+			if (inputs->getParInt("Segmentationoffload")) {
+				// Lay chunks out back to back: all chunks but the last one have the same size,
+				// so the kernel can cut the buffer at a fixed stride and datagrams stay identical on the wire
+				segmentedData.clear();
+				for (const auto& chunk : chunks) {
+					const auto header = static_cast<const unsigned char*>(chunk.header);
+					const auto payload = static_cast<const unsigned char*>(chunk.payload);
+					segmentedData.insert(segmentedData.end(), header, header + chunk.headerLen);
+					segmentedData.insert(segmentedData.end(), payload, payload + chunk.payloadLen);
+				}
+				socket->sendSegmented(destAddr, &segmentedData[0], static_cast<unsigned int>(segmentedData.size()),
+					PONK_MAX_DATA_BYTES_PER_PACKET);
+			} else {
+				socket->sendBatch(destAddr, &chunks[0], chunksCount);
+			}
 		}
 
 		//std::cout << "Sent frame " << std::to_string(frameNumber) << std::endl;
@@ -620,6 +651,95 @@ PonkOutput::setupParameters(OP_ParameterManager* manager, void* reserved)
         assert(res == OP_ParAppendResult::Success);
 	}
 
+	// Multicast: a single stream for every receiver that joined the group
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Multicast";
+		np.label = "Multicast";
+
+		OP_ParAppendResult res = manager->appendToggle(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Multicastgroup";
+		np.label = "Multicast Group";
+
+		for (int i = 0; i < 4; i++) {
+			np.minValues[i] = 0;
+			np.maxValues[i] = 255;
+		}
+
+		// PONK_DEFAULT_MULTICAST_GROUP
+		np.defaultValues[0] = 239;
+		np.defaultValues[1] = 255;
+		np.defaultValues[2] = 55;
+		np.defaultValues[3] = 83;
+
+		OP_ParAppendResult res = manager->appendInt(np, 4);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Multicastinterface";
+		np.label = "Multicast Interface";
+
+		// 0.0.0.0 lets the OS pick the interface from its routing table
+		for (int i = 0; i < 4; i++) {
+			np.minValues[i] = 0;
+			np.maxValues[i] = 255;
+		}
+
+		OP_ParAppendResult res = manager->appendInt(np, 4);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Multicastttl";
+		np.label = "Multicast TTL";
+
+		// 1 keeps datagrams on the local network
+		np.defaultValues[0] = 1;
+		np.minValues[0] = 0;
+		np.maxValues[0] = 255;
+		np.clampMins[0] = true;
+		np.clampMaxes[0] = true;
+
+		OP_ParAppendResult res = manager->appendInt(np, 1);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Multicastloopback";
+		np.label = "Multicast Loopback";
+
+		// Also deliver to receivers running on this computer
+		np.defaultValues[0] = 1;
+
+		OP_ParAppendResult res = manager->appendToggle(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// UDP Segmentation Offload
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Segmentationoffload";
+		np.label = "UDP Segmentation Offload";
+
+		OP_ParAppendResult res = manager->appendToggle(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
 	// Primitive data
 	{
 		OP_StringParameter sopp;
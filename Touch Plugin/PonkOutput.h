@@ -2,12 +2,12 @@
 
 #include "DatagramSocket/DatagramSocket.h"
 #include "PonkDefs.h"
+#include "PonkMetaData/PonkMetaData.h"
 
 #include "SOP_CPlusPlusBase.h"
 #include <string>
 
 #include <vector>
-#include <map>
 #include <string>
 #include "matrix.h"
 
@@ -47,12 +47,11 @@ private:
 	void push16bits(std::vector<unsigned char>& fullData, unsigned short value);
     void push32bits(std::vector<unsigned char>& fullData, int value);
     void pushFloat32(std::vector<unsigned char>& fullData, float value);
-	void pushMetaData(std::vector<unsigned char>& fullData, const char(&eightCC)[9], int value);
-	void pushMetaData(std::vector<unsigned char>& fullData, const char(&eightCC)[9], float value);
+	void pushMetaData(std::vector<unsigned char>& fullData, PonkMetaDataKey key, float value);
     void pushPoint_XYRGB_U16(std::vector<unsigned char>& fullData, const Position& pointPosition, const Color& pointColor);
     void pushPoint_XY_F32_RGB_U8(std::vector<unsigned char>& fullData, const Position& pointPosition, const Color& pointColor);
 	bool validatePrimitiveDat(const OP_DATInput* primitive, int numPrimitive);
-	std::map<std::string, float> getMetadata(const OP_DATInput* primitive, int primitiveIndex);
+	void getMetadataKeys(const OP_DATInput* primitive);
 
 	Matrix44<double> buildCameraTransProjMatrix(const OP_Inputs* inputs);
 
@@ -77,6 +76,22 @@ private:
 
 	DatagramSocket* socket;
 
+	// Reused across cooks so sending a frame doesn't allocate
+	std::vector<GeomUdpHeader> chunkHeaders;
+	std::vector<DatagramChunk> chunks;
+	std::vector<unsigned char> segmentedData;
+	// Keys of the meta data columns of the primitive DAT, read once per cook
+	std::vector<PonkMetaDataKey> metadataKeys;
+
+	// Multicast settings last applied to the socket, only changed when parameters change
+	struct MulticastOutput {
+		unsigned int interfaceIp = 0;
+		int ttl = 1;
+		bool loopback = true;
+	};
+	MulticastOutput multicastOutput;
+	bool multicastOutputApplied = false;
+
 	double animTime = 0;
 	unsigned char frameNumber = 0;
 };